@@ -4,718 +4,1036 @@
 */
 
 #include <iostream>
+#include <limits>
 #include <fstream>
 #include <vector>
-#include <queue>
 #include <cmath>
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
+#include <string_view>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "PedigreeEngine.h"
+#include "PedigreeJson.h"
+#include "PedigreeServer.h"
 
 using namespace std;
 
-// People
-const int maxNumOfPeople = 2e5;
-int numOfPeople;
-vector<int> gender; // 1 if Female.
-vector<bool> AffectionFile;
-
-// Pedigree
-int Partner[maxNumOfPeople];
-vector<pair<int, int>> Parents;
-vector<int> Children[maxNumOfPeople];
-
-// bfs
-queue<int> Headers;
-bool bfsMarker[maxNumOfPeople];
-bool subTreeMarker[maxNumOfPeople]; // Flaged with the mother
-
-// Probability
-double Gene_Prob[maxNumOfPeople][5][7];
-double Model_Prob[5];
-/*
-    5 Modes
-    Female Genes: {DD, DR, RR, XdXd, XdXr, XrXr}
-    Male Genes: {DD, DR, RR, XdY, XrY, XY*, XY}
-*/
-pair<double, string> mostLikableModel[5];
-
-void bfs(int);
-void autoDomProb(int);
-void autoRecProb(int);
-void xLinkedDomProb(int);
-void xLinkedRecProb(int);
-void yLinked(int);
-void PedStarters(int);
-
-double ChildrenAffectionProb(int, double);
-double DaughtersAffectionProb(int, double);
-double SonsAffectionProb(int, double);
-double ADModelProb(int);
-double ARModelProb(int);
-double XLDModeProbe(int);
-double XLRModeProbe(int);
-double YLModeProbe(int);
-
-
-void exportToDOT(const string &filename)
+// Counts heap allocations for --stats; a relaxed load when it is off.
+__attribute__((noinline)) void *operator new(size_t size)
 {
-    ofstream out(filename);
-    out << "digraph Pedigree {\n";
-    out << "  rankdir=TB;\n"; // Tree layout: top to bottom
-    out << "  node [fontname=\"Arial\", fontsize=12, style=filled, fillcolor=white];\n";
-    out << "  edge [color=gray50];\n\n";
-
-    // Draw individuals
-    for (int i = 0; i < numOfPeople; i++)
+    if (heapCounting.load(memory_order_relaxed))
     {
-        string nodeName = "Person_" + to_string(i + 1);
-        string shape = gender[i] ? "circle" : "box"; // Female: circle, Male: box
-        string color = AffectionFile[i] ? "red" : "black";
-        string genderSymbol = gender[i] ? "♀" : "♂";
-
-        out << "  " << nodeName << " [label=\"" << genderSymbol << " " << i + 1
-            << "\", shape=" << shape << ", color=" << color << "];\n";
+        heapAllocations.fetch_add(1, memory_order_relaxed);
+        heapBytes.fetch_add(size, memory_order_relaxed);
+        threadAllocations++;
     }
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
 
-    out << "\n";
-
-    // Draw couples and children
-    for (int i = 0; i < numOfPeople; i++)
-    {
-        int partner = Partner[i];
-        if (partner != -1 && i < partner)
-        {
-            string coupleNode = "Couple_" + to_string(i + 1) + "_" + to_string(partner + 1);
-
-            // Align couple horizontally
-            out << "  { rank=same; Person_" << i + 1 << "; Person_" << partner + 1 << "; }\n";
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
 
-            // Invisible anchor node
-            out << "  " << coupleNode << " [shape=point, width=0, label=\"\"];\n";
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
 
-            // Horizontal line between partners
-            out << "  Person_" << i + 1 << " -> " << coupleNode << " [dir=none, constraint=false, color=gray70];\n";
-            out << "  Person_" << partner + 1 << " -> " << coupleNode << " [dir=none, constraint=false, color=gray70];\n";
+void PrintUsage(const char *program)
+{
+    cout << "Usage: " << program << " [--input <file|->] [--format ped|csv] [--threads N] [--stats <file|->]" << endl;
+    cout << "       " << string(strlen(program), ' ') << " [--engine forward|peeling|both|mcmc] [--mcmc-chains N] [--mcmc-rungs N] [--mcmc-sweeps N]" << endl;
+    cout << "       " << string(strlen(program), ' ') << " [--export dot|json|none] [--output <file>] [--shard]" << endl;
+    cout << "       " << string(strlen(program), ' ') << " [--snapshot <file>] [--save-snapshot <file>] [--cache MB] [--prune-bound B]" << endl;
+    cout << "       " << string(strlen(program), ' ') << " [--components] [--posteriors <file|->] [--significance N] [--significance-seed N]" << endl;
+    cout << "       " << string(strlen(program), ' ') << " [--traits <file|->] [--trait-columns first[,count]]" << endl;
+    cout << "       " << program << " --batch --input <file|-> [--results <file>] [--results-format tsv|json]" << endl;
+    cout << "       " << program << " --serve <-|socket> [--queue N] [--engine forward|peeling|mcmc] [--threads N]" << endl;
+    cout << "  --input          Read the whole pedigree from a PED/LINKAGE or CSV file (- for stdin)." << endl;
+    cout << "  --format         Input layout; guessed from the first line when omitted." << endl;
+    cout << "  --snapshot       Load a binary snapshot written by --save-snapshot instead of --input." << endl;
+    cout << "  --save-snapshot  After the analysis, save the pedigree and its schedule as a binary" << endl;
+    cout << "                   snapshot that later runs map instead of parsing the input again." << endl;
+    cout << "  --engine         forward (default): the fast top-down pass; peeling: exact likelihoods," << endl;
+    cout << "                   for pedigrees without loops; both: peeling, compared with the forward" << endl;
+    cout << "                   pass and timed against it; mcmc: Gibbs sampling estimates, for pedigrees" << endl;
+    cout << "                   with loops (marriage loops, consanguinity)." << endl;
+    cout << "  --mcmc-chains    Independent chains per mode, run in parallel (default: 4)." << endl;
+    cout << "  --mcmc-rungs     Rungs of the annealing ladder (default: 32). The reported error includes" << endl;
+    cout << "                   the ladder's discretisation error; more rungs shrink it." << endl;
+    cout << "  --mcmc-sweeps    Sampled sweeps per rung of the annealing ladder (default: 100)." << endl;
+    cout << "  --mcmc-seed      Seed of the chains' generators (default: 1)." << endl;
+    cout << "  --threads        Worker threads for the analysis (default: all cores)." << endl;
+    cout << "  --cache          Keep up to MB of nuclear-family results (factors and children's genes)" << endl;
+    cout << "                   and reuse them for families with the same parental genes and sibship;" << endl;
+    cout << "                   shared by the batch workers (default: 0, off)." << endl;
+    cout << "  --components     Analyse every connected family of the input on its own, side by side on" << endl;
+    cout << "                   the threads, and list their results after the report; the models are" << endl;
+    cout << "                   ranked on the sums over the families." << endl;
+    cout << "  --prune-bound    The forward pass stops following a mode once it has probability 0; with" << endl;
+    cout << "                   this, also once its log-likelihood so far is more than B below the best" << endl;
+    cout << "                   mode's; such a mode is reported as -inf (default: off)." << endl;
+    cout << "  --export         Pedigree graph format (default: dot), or none to skip the export." << endl;
+    cout << "  --output         Where the graph goes (default: pedigree.dot / pedigree.json)." << endl;
+    cout << "  --shard          One graph file per connected family: <output>.1.dot, <output>.2.dot, ..." << endl;
+    cout << "  --stats          Write timers, counters, peak memory and per-thread busy time as JSON" << endl;
+    cout << "                   to <file> when the run ends (- for stderr)." << endl;
+    cout << "  --batch          Analyse every PED family separately, one results row per family." << endl;
+    cout << "  --results        Where batch results go (default: stdout)." << endl;
+    cout << "  --results-format tsv (default) or json (one object per line)." << endl;
+    cout << "  --serve          Stay up and analyse pedigrees sent on stdin (-) or on a Unix socket, one" << endl;
+    cout << "                   JSON line back per request; see PedigreeServer.cpp for the protocol." << endl;
+    cout << "                   --threads requests are analysed at once." << endl;
+    cout << "  --queue          Requests --serve holds before it stops reading, and connections it reads" << endl;
+    cout << "                   at once (default: 64)." << endl;
+    cout << "  --edit           After the report, read edits (affection changes, newborns) from stdin" << endl;
+    cout << "                   and re-rank the models incrementally after each one." << endl;
+    cout << "  --posteriors     After the report, write every person's posterior state probabilities under" << endl;
+    cout << "                   each mode and their carrier risk, averaged over the modes by their exact" << endl;
+    cout << "                   likelihoods, as TSV to <file> (- for stdout). Needs a pedigree without loops." << endl;
+    cout << "  --significance   After the report, re-score N pedigrees with the affections shuffled and N" << endl;
+    cout << "                   with affections simulated under the best mode: permutation p-values per" << endl;
+    cout << "                   mode, and how often each mode ranks first on the simulated ones." << endl;
+    cout << "  --significance-seed  Seed of the replicates' generators (default: 1)." << endl;
+    cout << "  --traits         After the report, score the affection column and every trait column of the" << endl;
+    cout << "                   input as a trait of its own, all in one traversal, and write every mode's" << endl;
+    cout << "                   log-likelihood per trait as TSV to <file> (- for stdout). The report is on" << endl;
+    cout << "                   the affection column." << endl;
+    cout << "  --trait-columns  The trait columns: first .. first + count - 1, numbered from 1 (default" << endl;
+    cout << "                   count: through the last column). Without it, a CSV file with a header line" << endl;
+    cout << "                   takes every column after partner, named by the header; other input with" << endl;
+    cout << "                   more columns is refused, as PED marker genotypes would read as affections." << endl;
+    cout << "  --sweep          After the report, write every mode's log-likelihood over a parameter grid" << endl;
+    cout << "                   as TSV to <file> (- for stdout). Each axis is a list 'a,b,c' or 'from:to:count':" << endl;
+    cout << "  --sweep-q          disease allele frequency, or 'uniform' for the report's founder prior" << endl;
+    cout << "                     (default: 0.01)" << endl;
+    cout << "  --sweep-penetrance P(affected | disease genotype) (default: 1)" << endl;
+    cout << "  --sweep-phenocopy  P(affected | other genotypes) (default: 0)" << endl;
+    cout << "                   q uniform, penetrance 1 and phenocopy 0 is the report's own model." << endl;
+    cout << "  --sweep-memory   MB of lanes per traversal of --sweep or --traits; larger grids and more" << endl;
+    cout << "                   traits than fit take several (default: 1024)." << endl;
+    cout << "Without --input the pedigree is entered interactively." << endl;
+}
 
-            // Children descend from couple node
-            for (int child : Children[i])
-            {
-                if (Parents[child].first == i || Parents[child].second == i)
-                    out << "  " << coupleNode << " -> Person_" << child + 1 << " [color=gray30];\n";
-            }
+string FormatLogLikelihood(double value, bool json)
+{
+    if (value == -INFINITY)
+        return json ? "null" : "-inf";
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.10g", value);
+    return buffer;
+}
 
-            out << "\n";
-        }
+// One results row: the ranking and the log-likelihood of every mode.
+string FormatResult(string_view family, const PedigreeEngine &engine, bool json)
+{
+    string row;
+    if (json)
+    {
+        row = "{\"family\":" + JsonString(family) + ",\"people\":" + to_string(engine.size());
+        row += ",\"best\":\"" + string(modeCodes[engine.rankedMode(0)]) + "\",\"ranking\":[";
+        for (int i = 0; i < 5; i++)
+            row += string(i ? "," : "") + "\"" + modeCodes[engine.rankedMode(i)] + "\"";
+        row += "],\"logLikelihood\":{";
+        for (int mode = 0; mode < 5; mode++)
+            row += string(mode ? "," : "") + "\"" + modeCodes[mode] + "\":" + FormatLogLikelihood(engine.logLikelihoods()[mode], true);
+        row += "}}\n";
+    }
+    else
+    {
+        row = string(family) + "\t" + to_string(engine.size()) + "\t" + modeCodes[engine.rankedMode(0)] + "\t";
+        for (int i = 0; i < 5; i++)
+            row += string(i ? ">" : "") + modeCodes[engine.rankedMode(i)];
+        for (int mode = 0; mode < 5; mode++)
+            row += "\t" + FormatLogLikelihood(engine.logLikelihoods()[mode], false);
+        row += "\n";
     }
+    return row;
+}
 
-    out << "}\n";
-    out.close();
+// --cache: how often a family was found, on stderr and in the --stats report.
+void ReportCache(const FamilyCache *cache, PedigreeStats *stats)
+{
+    if (!cache)
+        return;
+    long long hits = cache->hits(), misses = cache->misses();
+    cerr << "Family cache: " << hits << " hits, " << misses << " misses ("
+         << (hits + misses ? 100.0 * hits / (hits + misses) : 0) << "% hit rate), " << cache->evictions()
+         << " evicted" << endl;
+    if (stats)
+    {
+        stats->cacheHits = hits;
+        stats->cacheMisses = misses;
+        stats->cacheEvictions = cache->evictions();
+    }
 }
 
-int main()
+// Batch mode: every family of the input is its own pedigree, analysed on the pool.
+int RunBatch(const string &inputPath, const string &format, const string &resultsPath, bool json,
+             const string &engineName, const McmcOptions &mcmc, double pruneBound, FamilyCache *cache,
+             ThreadPool &pool, PedigreeStats *stats)
 {
-    for (int i = 0; i < 5; i++)
-        Model_Prob[i] = 1.0;
+    auto start = chrono::steady_clock::now();
+    auto inputTimer = make_unique<PhaseTimer>(stats, PhaseInput);
+    vector<InputRow> rows;
+    vector<string_view> families;
+    PersonIndex ids;
+    string error;
+    InputBuffer input;
+    if (!ReadInput(inputPath, input, error) || !ParseRows(input.text(), format, rows, families, error))
+    {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
 
-    // Getting the input pedigree...
-    cout << "Hello dear user!" << endl;
-    cout << "Please enter the number of people in your pedigree: ";
-    cin >> numOfPeople;
-    for (int i = 0; i < numOfPeople; i++)
-    {
-        bool gndr;
-        cout << "Enter the gender of person #" << i + 1 << ":" << endl;
-        cout << "1 if Female / 0 if Male -> ";
-        cin >> gndr;
-        gender.push_back(gndr);
-
-        pair<int, int> prnts;
-        cout << "Enter parents of #" << i + 1 << ":" << endl;
-        cout << "No parents? Just enter 0 as their parents." << endl;
-        cout << "#" << i + 1 << "'s mother -> ";
-        cin >> prnts.first;
-        cout << "#" << i + 1 << "'s father -> ";
-        cin >> prnts.second;
-        prnts.first--;
-        prnts.second--;
-        Parents.push_back(prnts);
-        if (prnts.first != -1)
+    // Each family's rows together, in file order inside the family.
+    stable_sort(rows.begin(), rows.end(), [](const InputRow &a, const InputRow &b) { return a.family < b.family; });
+    if (!IndexRows(rows, ids, error))
+    {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    int numOfFamilies = families.size();
+    vector<int> familyStart(numOfFamilies + 1, 0);
+    for (const InputRow &row : rows)
+        familyStart[row.family + 1]++;
+    for (int f = 0; f < numOfFamilies; f++)
+        familyStart[f + 1] += familyStart[f];
+    inputTimer.reset();
+
+    vector<string> results(numOfFamilies), errors(numOfFamilies);
+    // One engine per thread, reused by every family it analyses: after the
+    // first few families its buffers are big enough and nothing is allocated.
+    vector<PedigreeEngine> engines(pool.size());
+    for (PedigreeEngine &engine : engines)
+    {
+        engine.setStats(stats);
+        engine.setCache(cache);
+        engine.setPruneBound(pruneBound);
+    }
+    pool.parallelFor(numOfFamilies, 8, [&](int begin, int end) {
+        PedigreeEngine &engine = engines[ThreadPool::threadIndex()];
+        for (int f = begin; f < end; f++)
         {
-            Children[prnts.first].push_back(i);
-            Children[prnts.second].push_back(i);
+            if (!engine.loadRows(rows, familyStart[f], familyStart[f + 1], ids, errors[f]))
+                continue;
+            if (stats)
+            {
+                stats->families++;
+                stats->people += engine.size();
+            }
+            McmcReport report;
+            if (engineName == "peeling" ? !engine.peel(errors[f])
+                : engineName == "mcmc"  ? !engine.sample(mcmc, report, errors[f])
+                                        : (engine.analyze(), false))
+                continue;
+            engine.rankModels();
+            results[f] = FormatResult(families[f], engine, json);
         }
-        else
-            Headers.push(i);
+    });
 
-        cout << "Enter the partner of #" << i + 1 << ":" << endl;
-        cout << "No partner? Enter 0." << endl;
-        cout << "-> ";
-        cin >> Partner[i];
-        Partner[i]--;
-
-        bool Affected;
-        cout << "Is #" << i + 1 << " affected? " << endl;
-        cout << "1 if yes / 0 if not -> ";
-        cin >> Affected;
-        AffectionFile.push_back(Affected);
+    PhaseTimer outputTimer(stats, PhaseOutput);
+    ofstream file;
+    if (resultsPath.size())
+    {
+        file.open(resultsPath);
+        if (!file)
+        {
+            cerr << "Error: cannot write " << resultsPath << endl;
+            return 1;
+        }
     }
+    ostream &out = resultsPath.size() ? file : cout;
+    if (!json)
+        out << "family\tpeople\tbest\tranking\tAD\tAR\tXLD\tXLR\tYL\n";
+    int failed = 0;
+    for (int f = 0; f < numOfFamilies; f++)
+    {
+        if (errors[f].size())
+        {
+            cerr << "Family " << families[f] << ": " << errors[f] << endl;
+            failed++;
+        }
+        else
+            out << results[f];
+    }
+    out.flush();
 
-    exportToDOT("pedigree.dot");
-
-    // Gene Probability Calculation
-    while (Headers.size())
-        bfs(Headers.front());
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "Analysed " << numOfFamilies - failed << " families (" << rows.size() << " people) in " << seconds
+         << " s, " << (numOfFamilies - failed) / max(seconds, 1e-9) << " families/s" << endl;
+    ReportCache(cache, stats);
+    return failed ? 1 : 0;
+}
 
+void PrintReport(PedigreeEngine &engine)
+{
     // Best Model
-    /* Normilizing:
-    double total = 0;
-    for (int i = 0; i < 5; i++)
-        total += Model_Prob[i]; // Assuming uniform priors
-
-    if (total > 0)
-    {
-        for (int i = 0; i < 5; i++)
-            Model_Prob[i] = Model_Prob[i] / total;
-    }
-    */
-    mostLikableModel[0].second = "Autosome Dominant Inheritance";
-    mostLikableModel[1].second = "Autosome Recessive Inheritance";
-    mostLikableModel[2].second = "X_Linked Dominant Inheritance";
-    mostLikableModel[3].second = "X_Linked Recessive Inheritance";
-    mostLikableModel[4].second = "Y_Linked Inheritance";
-    for (int i = 0; i < 5; i++)
-        mostLikableModel[i].first = Model_Prob[i];
-    sort(mostLikableModel, mostLikableModel + 5);
-    reverse(mostLikableModel, mostLikableModel + 5);
-    cout << "Best Model is : " << mostLikableModel[0].second << endl;
-    cout << "The lilkelihood of each model is:" << endl;
+    // Normalizing (assuming uniform priors):
+    double total = LogSumExp(engine.logLikelihoods(), 5);
+    engine.rankModels();
+    auto mostLikableModel = [&engine](int i) { return engine.rankedModel(i); };
+    cout << "Best Model is : " << mostLikableModel(0).second << endl;
+    cout << "The log-likelihood of each model is:" << endl;
     for (int i = 0; i < 5; i++)
     {
+        double logBF = mostLikableModel(i).first - mostLikableModel(0).first;
+        double posterior = total == -INFINITY ? 0 : exp(mostLikableModel(i).first - total);
         cout << i + 1 << ") ";
-        cout << mostLikableModel[i].first << " for " << mostLikableModel[i].second << endl;
+        cout << mostLikableModel(i).first << " for " << mostLikableModel(i).second;
+        cout << " (log Bayes factor vs best: " << (mostLikableModel(0).first == -INFINITY ? 0 : logBF);
+        cout << ", posterior: " << posterior << ")" << endl;
     }
+}
 
-    return 0;
+// --components: one row per connected family, by its first person.
+void PrintComponents(const PedigreeEngine &engine, const vector<ComponentResult> &results)
+{
+    cout << "Families analysed apart: " << results.size() << endl;
+    cout << "family\tfirst\tpeople\tbest\tAD\tAR\tXLD\tXLR\tYL" << endl;
+    for (size_t c = 0; c < results.size(); c++)
+    {
+        const ComponentResult &result = results[c];
+        int best = 0;
+        for (int mode = 1; mode < 5; mode++)
+            if (result.logLikelihood[mode] > result.logLikelihood[best])
+                best = mode;
+        string row = to_string(c + 1) + "\t" + engine.personID(result.first) + "\t" + to_string(result.people) + "\t" +
+                     (result.logLikelihood[best] == -INFINITY ? "none" : modeCodes[best]);
+        for (int mode = 0; mode < 5; mode++)
+            row += "\t" + FormatLogLikelihood(result.logLikelihood[mode], false);
+        cout << row << "\n";
+    }
+    cout.flush();
 }
 
-void bfs(int node)
+// Which modes the forward pass stopped following, why and where; on stderr,
+// next to the timings, so the report itself stays the same.
+void ReportPruning(const PedigreeEngine &engine, double bound)
 {
-    if (Parents[node].first == -1)
+    for (int mode = 0; mode < 5; mode++)
     {
-        PedStarters(node);
-        bfsMarker[node] = 1;
+        const ModePruning &pruned = engine.pruning(mode);
+        if (pruned.reason == ModePruning::Live)
+            continue;
+        string family = pruned.founder >= 0 ? "founder " + engine.personID(pruned.founder)
+                        : pruned.mating >= 0 ? "the family of " + engine.personID(engine.matingMother(pruned.mating)) +
+                                                   " and " + engine.personID(engine.matingFather(pruned.mating))
+                                             : "no single family";
+        string wave = pruned.wave < 0 ? "the founders" : "wave " + to_string(pruned.wave + 1);
+        if (pruned.reason == ModePruning::Impossible)
+            cerr << "Pruned " << modeCodes[mode] << " at " << wave << ": " << family << " has probability 0" << endl;
+        else
+            cerr << "Pruned " << modeCodes[mode] << " at " << wave << ": " << pruned.behind << " behind the best mode"
+                 << " (bound " << bound << "), most of it from " << family << endl;
     }
+}
 
-    int spouse = Partner[node];
-    int mother;
-    if (gender[node])
-        mother = node;
-    else
-        mother = spouse;
+// --engine both: the forward pass's log-likelihoods next to the exact ones, and what each took.
+void PrintComparison(const double *forward, const double *exact, double forwardSeconds, double peelSeconds)
+{
+    cout << "Forward pass vs exact (peeling) log-likelihoods:" << endl;
+    for (int mode = 0; mode < 5; mode++)
+        cout << modeCodes[mode] << "\t" << FormatLogLikelihood(forward[mode], false) << "\t"
+             << FormatLogLikelihood(exact[mode], false) << endl;
+    cerr << "Forward pass: " << forwardSeconds * 1e3 << " ms, peeling: " << peelSeconds * 1e3 << " ms" << endl;
+}
 
-    if (spouse != -1 && bfsMarker[spouse] && !subTreeMarker[mother])
+// --engine mcmc: how far each estimate can be trusted, and the sampling throughput.
+void PrintMcmcReport(const double *estimates, const McmcReport &report, double seconds)
+{
+    cout << "MCMC estimates (log-likelihood, error, R-hat):" << endl;
+    for (int mode = 0; mode < 5; mode++)
     {
-        subTreeMarker[mother] = 1;
-        Model_Prob[0] *= ADModelProb(mother);
-        Model_Prob[1] *= ARModelProb(mother);
-        Model_Prob[2] *= XLDModeProbe(mother);
-        Model_Prob[3] *= XLRModeProbe(mother);
-        Model_Prob[4] *= YLModeProbe(mother);
-
-        for (int i = 0; i < Children[node].size(); i++)
-        {
-            int Child = Children[node][i];
-            autoDomProb(Child);
-            autoRecProb(Child);
-            xLinkedDomProb(Child);
-            xLinkedRecProb(Child);
-            yLinked(Child);
-            bfsMarker[Child] = 1;
-            Headers.push(Child);
-        }
+        cout << modeCodes[mode] << "\t" << FormatLogLikelihood(estimates[mode], false) << "\t"
+             << report.error[mode] << "\t";
+        if (isnan(report.rHat[mode]))
+            cout << "n/a" << endl;
+        else
+            cout << report.rHat[mode] << endl;
     }
-    // Else? We will get here from the other parent!
+    cerr << "Sampled " << report.sweeps << " sweeps in " << seconds << " s (" << report.sweeps / max(seconds, 1e-9)
+         << " sweeps/s)" << endl;
+}
 
-    Headers.pop();
-    return;
+// --significance: permutation p-values and bootstrap selection frequencies.
+void PrintSignificance(const PedigreeEngine &engine, const SignificanceOptions &options,
+                       const SignificanceReport &report, double seconds)
+{
+    cout << "Significance (" << options.replicates << " permutations";
+    if (report.simulatedMode >= 0)
+        cout << ", " << options.replicates << " pedigrees simulated under " << modeCodes[report.simulatedMode];
+    cout << "):" << endl;
+    cout << "Model\tlog L\tp (permutation)\tranked first (simulated)" << endl;
+    for (int i = 0; i < 5; i++)
+    {
+        int mode = engine.rankedMode(i);
+        cout << modeCodes[mode] << "\t" << FormatLogLikelihood(engine.logLikelihoods()[mode], false) << "\t"
+             << report.permutationP[mode] << "\t";
+        if (report.simulatedMode >= 0)
+            cout << report.selected[mode] << endl;
+        else
+            cout << "n/a" << endl;
+    }
+    int replicates = options.replicates * (report.simulatedMode >= 0 ? 2 : 1);
+    cerr << "Scored " << replicates << " replicates in " << seconds << " s (" << replicates / max(seconds, 1e-9)
+         << " replicates/s)" << endl;
 }
 
-void PedStarters(int node)
+// Reads edits from stdin and re-ranks the models after each one, recomputing only what changed.
+void RunEditLoop(PedigreeEngine &engine, PedigreeStats *stats)
 {
-    if (!Children[node].size())
+    unordered_map<string, int> index;
+    for (int i = 0; i < engine.size(); i++)
+        index[engine.personID(i)] = i;
+    auto lookup = [&index](const string &id) {
+        if (id == "0")
+            return -1;
+        auto it = index.find(id);
+        return it == index.end() ? -2 : it->second;
+    };
+
+    cout << "Edit commands: 'affect <id> <1|0>', 'add <id> <mother|0> <father|0> <F|M> <1|0>', 'quit'." << endl;
+    string command;
+    while (cin >> command && command != "quit")
     {
-        Model_Prob[0] *= ((AffectionFile[node] * 2.0 / 3.0) + (!AffectionFile[node] * 1.0 / 3.0));
-        Model_Prob[1] *= ((AffectionFile[node] * 1.0 / 3.0) + (!AffectionFile[node] * 2.0 / 3.0));
-        if (gender[node])
+        auto start = chrono::steady_clock::now();
+        string error;
+        if (command == "affect")
+        {
+            string id;
+            bool affected;
+            cin >> id >> affected;
+            int person = lookup(id);
+            if (person < 0)
+                error = "unknown person '" + id + "'";
+            else
+                engine.SetAffection(person, affected);
+        }
+        else if (command == "add")
         {
-            Model_Prob[2] *= ((AffectionFile[node] * 2.0 / 3.0) + (!AffectionFile[node] * 1.0 / 3.0));
-            Model_Prob[3] *= ((AffectionFile[node] * 1.0 / 3.0) + (!AffectionFile[node] * 2.0 / 3.0));
-            Model_Prob[4] *= ((AffectionFile[node] * 0) + (!AffectionFile[node] * 1));
+            string id, mother, father, sex;
+            bool affected;
+            cin >> id >> mother >> father >> sex >> affected;
+            int m = lookup(mother), f = lookup(father);
+            if (index.count(id))
+                error = "'" + id + "' is already in the pedigree";
+            else if (m == -2 || f == -2)
+                error = "unknown parent";
+            else if (sex != "F" && sex != "M")
+                error = "sex must be F or M";
+            else if (engine.AddPerson(id, sex == "F", m, f, affected, error))
+                index[id] = engine.size() - 1;
         }
         else
         {
-            Model_Prob[2] *= ((AffectionFile[node] * 1.0 / 2.0) + (!AffectionFile[node] * 1.0 / 2.0));
-            Model_Prob[3] *= ((AffectionFile[node] * 1.0 / 2.0) + (!AffectionFile[node] * 1.0 / 2.0));
-            Model_Prob[4] *= ((AffectionFile[node] * 1.0 / 2.0) + (!AffectionFile[node] * 1.0 / 2.0));
+            error = "unknown command '" + command + "'";
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
         }
-    }
-    if (AffectionFile[node])
-    {
-        // Mode 0 -> DD or DR
-        Gene_Prob[node][0][0] = 0.5;
-        Gene_Prob[node][0][1] = 0.5;
 
-        // Mode 1 -> RR
-        Gene_Prob[node][1][2] = 1;
-
-        // Mode 2
-        if (gender[node])
+        if (error.size())
         {
-            // XdXd or XdXr
-            Gene_Prob[node][2][3] = 0.5;
-            Gene_Prob[node][2][4] = 0.5;
+            cout << "Error: " << error << endl;
+            continue;
         }
-        else
-            // XdY
-            Gene_Prob[node][2][3] = 1;
-
-        // Mode 3
-        if (gender[node])
-            // XrXr
-            Gene_Prob[node][3][5] = 1;
-        else
-            // XrY
-            Gene_Prob[node][3][4] = 1;
-
-        // Mode 4
-        if (!gender[node])
-            // XY*
-            Gene_Prob[node][4][5] = 1;
+        auto elapsed = chrono::steady_clock::now() - start;
+        if (stats)
+            stats->phaseTime[PhaseEdit] += chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+        cout << "Updated in " << chrono::duration<double, milli>(elapsed).count() << " ms" << endl;
+        PrintReport(engine);
+    }
+}
 
-        // Others are 0 by default.
+// A --sweep-* axis: "0.1,0.2,0.5" or "from:to:count" (evenly spaced, both ends included).
+// With uniform, "uniform" is a value too, stored as NaN.
+bool ParseSweepAxis(const string &text, vector<double> &axis, bool uniform)
+{
+    axis.clear();
+    double from, to;
+    int count, used = 0;
+    if (sscanf(text.c_str(), "%lf:%lf:%d%n", &from, &to, &count, &used) == 3 && used == (int)text.size())
+    {
+        if (count < 1)
+            return false;
+        for (int i = 0; i < count; i++)
+            axis.push_back(count == 1 ? from : from + (to - from) * i / (count - 1));
     }
     else
     {
-        // Mode 0 -> RR
-        Gene_Prob[node][0][2] = 1;
-
-        // Mode 1 -> DD or DR
-        Gene_Prob[node][1][0] = 0.5;
-        Gene_Prob[node][1][1] = 0.5;
-
-        // Mode 2
-        if (gender[node])
-            // XrXr
-            Gene_Prob[node][2][5] = 1;
-        else
-            // XrY
-            Gene_Prob[node][2][4] = 1;
-
-        // Mode 3
-        if (gender[node])
+        size_t begin = 0;
+        while (begin <= text.size())
         {
-            // XdXd or XdXr
-            Gene_Prob[node][3][3] = 0.5;
-            Gene_Prob[node][3][4] = 0.5;
+            size_t end = min(text.find(',', begin), text.size());
+            string value = text.substr(begin, end - begin);
+            char *rest;
+            if (uniform && value == "uniform")
+                axis.push_back(NAN);
+            else
+            {
+                axis.push_back(strtod(value.c_str(), &rest));
+                if (value.empty() || *rest || isnan(axis.back()))
+                    return false;
+            }
+            begin = end + 1;
         }
-        else
-            // XdY
-            Gene_Prob[node][3][3] = 1;
-
-        // Mode 4
-        if (!gender[node])
-            // XY
-            Gene_Prob[node][4][6] = 1;
-
-        // Others are 0 by default.
     }
-
-    return;
-}
-
-void autoDomProb(int node)
-{
-    int mom = Parents[node].first;
-    int dad = Parents[node].second;
-
-    // DD / Affected.
-    Gene_Prob[node][0][0] = (Gene_Prob[mom][0][0] + 0.5 * Gene_Prob[mom][0][1]) *
-                            (Gene_Prob[dad][0][0] + 0.5 * Gene_Prob[dad][0][1]);
-
-    // RR
-    Gene_Prob[node][0][2] = (Gene_Prob[mom][0][2] + 0.5 * Gene_Prob[mom][0][1]) *
-                            (Gene_Prob[dad][0][2] + 0.5 * Gene_Prob[dad][0][1]);
-
-    // DR / Affected.
-    Gene_Prob[node][0][1] = 1 - (Gene_Prob[node][0][0] + Gene_Prob[node][0][2]);
-
-    // Considering the facts...
-    Gene_Prob[node][0][0] *= AffectionFile[node];
-    Gene_Prob[node][0][1] *= AffectionFile[node];
-    Gene_Prob[node][0][2] *= !AffectionFile[node];
-
-    return;
+    for (double value : axis)
+        if (!(value >= 0 && value <= 1) && !isnan(value))
+            return false;
+    return true;
 }
 
-void autoRecProb(int node)
+// Sweeps the analysed pedigree over the grid and writes one TSV row per point.
+int RunSweep(PedigreeEngine &engine, const SweepGrid &grid, const string &path, size_t memoryBytes)
 {
-    int mom = Parents[node].first;
-    int dad = Parents[node].second;
-
-    // DD
-    Gene_Prob[node][1][0] = (Gene_Prob[mom][1][0] + 0.5 * Gene_Prob[mom][1][1]) *
-                            (Gene_Prob[dad][1][0] + 0.5 * Gene_Prob[dad][1][1]);
-
-    // RR Affected.
-    Gene_Prob[node][1][2] = (Gene_Prob[mom][1][2] + 0.5 * Gene_Prob[mom][1][1]) *
-                            (Gene_Prob[dad][1][2] + 0.5 * Gene_Prob[dad][1][1]);
-
-    // DR
-    Gene_Prob[node][1][1] = 1 - (Gene_Prob[node][1][0] + Gene_Prob[node][1][2]);
-
-    // Considering the facts...
-    Gene_Prob[node][1][0] *= !AffectionFile[node];
-    Gene_Prob[node][1][1] *= !AffectionFile[node];
-    Gene_Prob[node][1][2] *= AffectionFile[node];
+    auto start = chrono::steady_clock::now();
+    vector<array<double, 5>> surface;
+    int passes = engine.sweep(grid, surface, memoryBytes);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    return;
+    ofstream file;
+    if (path != "-")
+    {
+        file.open(path);
+        if (!file)
+        {
+            cerr << "Error: cannot write " << path << endl;
+            return 1;
+        }
+    }
+    ostream &out = path != "-" ? file : cout;
+    out << "q\tpenetrance\tphenocopy\tAD\tAR\tXLD\tXLR\tYL\tbest\n";
+    for (size_t k = 0; k < surface.size(); k++)
+    {
+        double q, f, p;
+        grid.point(k, q, f, p);
+        string row = (isnan(q) ? string("uniform") : FormatLogLikelihood(q, false)) + "\t" +
+                     FormatLogLikelihood(f, false) + "\t" + FormatLogLikelihood(p, false);
+        int best = 0;
+        for (int mode = 0; mode < 5; mode++)
+        {
+            row += "\t" + FormatLogLikelihood(surface[k][mode], false);
+            if (surface[k][mode] > surface[k][best])
+                best = mode;
+        }
+        out << row << "\t" << modeCodes[best] << "\n";
+    }
+    out.flush();
+    cerr << "Swept " << surface.size() << " grid points in " << seconds << " s (" << passes
+         << (passes == 1 ? " traversal)" : " traversals)") << endl;
+    return 0;
 }
 
-void xLinkedDomProb(int node)
+// --traits: one row per affection column of the input.
+int RunTraits(PedigreeEngine &engine, const string &path, size_t memoryBytes)
 {
-    int mom = Parents[node].first;
-    int dad = Parents[node].second;
+    auto start = chrono::steady_clock::now();
+    vector<array<double, 5>> matrix;
+    int passes = engine.analyzeTraits(matrix, memoryBytes);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    if (gender[node])
+    ofstream file;
+    if (path != "-")
     {
-        // XdXd Affected.
-        Gene_Prob[node][2][3] = Gene_Prob[dad][2][3] *
-                                (Gene_Prob[mom][2][3] + 0.5 * Gene_Prob[mom][2][4]);
-
-        // XrXr
-        Gene_Prob[node][2][5] = Gene_Prob[dad][2][4] *
-                                (Gene_Prob[mom][2][5] + 0.5 * Gene_Prob[mom][2][4]);
-
-        // XrXd Affected.
-        Gene_Prob[node][2][4] = 1 - (Gene_Prob[node][2][3] + Gene_Prob[node][2][5]);
-
-        // Considering the facts...
-        Gene_Prob[node][2][3] *= AffectionFile[node];
-        Gene_Prob[node][2][4] *= AffectionFile[node];
-        Gene_Prob[node][2][5] *= !AffectionFile[node];
+        file.open(path);
+        if (!file)
+        {
+            cerr << "Error: cannot write " << path << endl;
+            return 1;
+        }
     }
-    else
+    ostream &out = path != "-" ? file : cout;
+    out << "trait\tAD\tAR\tXLD\tXLR\tYL\tbest\n";
+    for (size_t t = 0; t < matrix.size(); t++)
     {
-        // XdY Affected.
-        Gene_Prob[node][2][3] = Gene_Prob[mom][2][3] + 0.5 * Gene_Prob[mom][2][4];
-
-        // XrY
-        Gene_Prob[node][2][4] = Gene_Prob[mom][2][5] + 0.5 * Gene_Prob[mom][2][4];
-
-        // Considering the facts...
-        Gene_Prob[node][2][3] *= AffectionFile[node];
-        Gene_Prob[node][2][4] *= !AffectionFile[node];
+        string row = engine.traitName(t);
+        int best = 0;
+        for (int mode = 0; mode < 5; mode++)
+        {
+            row += "\t" + FormatLogLikelihood(matrix[t][mode], false);
+            if (matrix[t][mode] > matrix[t][best])
+                best = mode;
+        }
+        out << row << "\t" << (matrix[t][best] == -INFINITY ? "none" : modeCodes[best]) << "\n";
     }
-
-    return;
+    out.flush();
+    cerr << "Scored " << matrix.size() << " traits in " << seconds << " s (" << passes
+         << (passes == 1 ? " traversal)" : " traversals)") << endl;
+    return 0;
 }
 
-void xLinkedRecProb(int node)
+// --posteriors: one row per person; NA where a mode cannot explain the pedigree
+// or the person's sex has no such state.
+int RunPosteriors(const PedigreeEngine &engine, const string &path)
 {
-    int mom = Parents[node].first;
-    int dad = Parents[node].second;
-
-    if (gender[node])
+    auto start = chrono::steady_clock::now();
+    PosteriorTable table;
+    string error;
+    if (!engine.posteriors(table, error))
     {
-        // XdXd
-        Gene_Prob[node][3][3] = Gene_Prob[dad][3][3] *
-                                (Gene_Prob[mom][3][3] + 0.5 * Gene_Prob[mom][3][4]);
-
-        // XrXr Affected.
-        Gene_Prob[node][3][5] = Gene_Prob[dad][3][4] *
-                                (Gene_Prob[mom][3][5] + 0.5 * Gene_Prob[mom][3][4]);
-
-        // XrXd
-        Gene_Prob[node][3][4] = 1 - (Gene_Prob[node][3][3] + Gene_Prob[node][3][5]);
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-        // Considering the facts...
-        Gene_Prob[node][3][3] *= !AffectionFile[node];
-        Gene_Prob[node][3][4] *= !AffectionFile[node];
-        Gene_Prob[node][3][5] *= AffectionFile[node];
+    ofstream file;
+    if (path != "-")
+    {
+        file.open(path);
+        if (!file)
+        {
+            cerr << "Error: cannot write " << path << endl;
+            return 1;
+        }
     }
-    else
+    ostream &out = path != "-" ? file : cout;
+    // State columns by index; X-linked and Y-linked ones name the female / male state.
+    const char *const stateNames[5][3] = {{"DD", "DR", "RR"},
+                                          {"DD", "DR", "RR"},
+                                          {"XdXd/XdY", "XdXr/XrY", "XrXr"},
+                                          {"XdXd/XdY", "XdXr/XrY", "XrXr"},
+                                          {"XX/XY*", "XY"}};
+    string header = "person\tsex\taffected";
+    for (int mode = 0; mode < 5; mode++)
+        for (int s = 0; s < modeStates[mode]; s++)
+            header += string("\t") + modeCodes[mode] + "." + stateNames[mode][s];
+    for (int mode = 0; mode < 5; mode++)
+        header += string("\t") + modeCodes[mode] + ".carrier";
+    out << header << "\tcarrier\n";
+    auto format = [](double value) {
+        if (isnan(value))
+            return string("NA");
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.6g", value);
+        return string(buffer);
+    };
+    string row;
+    for (int p = 0; p < engine.size(); p++)
     {
-        // XdY
-        Gene_Prob[node][3][3] = Gene_Prob[mom][3][3] + 0.5 * Gene_Prob[mom][3][4];
-
-        // XrY Affected.
-        Gene_Prob[node][3][4] = Gene_Prob[mom][3][5] + 0.5 * Gene_Prob[mom][3][4];
-
-        // Considering the facts...
-        Gene_Prob[node][3][3] *= !AffectionFile[node];
-        Gene_Prob[node][3][4] *= AffectionFile[node];
+        row = engine.personID(p) + (engine.isFemale(p) ? "\tF\t" : "\tM\t") + (engine.isAffected(p) ? "1" : "0");
+        for (int mode = 0; mode < 5; mode++)
+            for (int s = 0; s < modeStates[mode]; s++)
+                row += "\t" + format(table.state[mode][s][p]);
+        for (int mode = 0; mode < 5; mode++)
+            row += "\t" + format(table.carrier[mode][p]);
+        out << row << "\t" << format(table.carrierRisk[p]) << "\n";
     }
-
-    return;
+    out.flush();
+    cerr << "Posteriors for " << engine.size() << " people in " << seconds << " s; mode weights";
+    for (int mode = 0; mode < 5; mode++)
+        cerr << " " << modeCodes[mode] << " " << format(table.weight[mode]);
+    cerr << endl;
+    return 0;
 }
 
-void yLinked(int node)
+// Writes the --stats report when main returns, whichever way it does.
+struct StatsReport
 {
-    int mom = Parents[node].first;
-    int dad = Parents[node].second;
+    string path; // "-" for stderr.
+    const PedigreeStats *stats;
+    const ThreadPool *pool;
 
-    if (gender[node])
-        return;
-    else
+    ~StatsReport()
     {
-        // XY* Affected.
-        Gene_Prob[node][4][5] = Gene_Prob[dad][4][5];
-
-        // XY
-        Gene_Prob[node][4][6] = Gene_Prob[dad][4][6];
-
-        // Considering the facts...
-        Gene_Prob[node][4][5] *= AffectionFile[node];
-        Gene_Prob[node][4][6] *= !AffectionFile[node];
+        if (path.empty())
+            return;
+        string report = stats->json(pool);
+        if (path == "-")
+        {
+            cerr << report;
+            return;
+        }
+        ofstream out(path);
+        out << report;
+        if (!out)
+            cerr << "Error: cannot write " << path << endl;
     }
+};
 
-    return;
-}
-
-double ChildrenAffectionProb(int mother, double AffProb)
+int main(int argc, char *argv[])
 {
-    double prob = 1.0;
-    for (int i = 0; i < Children[mother].size(); i++)
+    string inputPath, inputFormat, resultsPath, resultsFormat = "tsv";
+    string exportFormat = "dot", outputPath, statsPath, sweepPath, snapshotPath, saveSnapshotPath, posteriorsPath;
+    string traitsPath;
+    int traitFirst = 0, traitCount = 0;
+    string engineName = "forward", servePath;
+    McmcOptions mcmc;
+    SignificanceOptions significance;
+    significance.replicates = 0;
+    SweepGrid grid{{0.01}, {1}, {0}};
+    size_t sweepMemory = 1024, cacheMemory = 0;
+    double pruneBound = INFINITY;
+    int threads = max(1u, thread::hardware_concurrency()), queue = 64;
+    bool batch = false, edit = false, shard = false, components = false;
+    for (int i = 1; i < argc; i++)
     {
-        int Child = Children[mother][i];
-        prob *= ((AffectionFile[Child] * AffProb) + (!AffectionFile[Child] * (1 - AffProb)));
+        string arg = argv[i];
+        if (arg == "--input" && i + 1 < argc)
+            inputPath = argv[++i];
+        else if (arg == "--format" && i + 1 < argc)
+            inputFormat = argv[++i];
+        else if (arg == "--snapshot" && i + 1 < argc)
+            snapshotPath = argv[++i];
+        else if (arg == "--save-snapshot" && i + 1 < argc)
+            saveSnapshotPath = argv[++i];
+        else if (arg == "--engine" && i + 1 < argc)
+            engineName = argv[++i];
+        else if (arg == "--mcmc-chains" && i + 1 < argc)
+            mcmc.chains = max(1, atoi(argv[++i]));
+        else if (arg == "--mcmc-rungs" && i + 1 < argc)
+            mcmc.rungs = max(3, atoi(argv[++i]));
+        else if (arg == "--mcmc-sweeps" && i + 1 < argc)
+            mcmc.sweeps = max(1, atoi(argv[++i]));
+        else if (arg == "--mcmc-seed" && i + 1 < argc)
+            mcmc.seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--cache" && i + 1 < argc)
+            cacheMemory = max(0, atoi(argv[++i]));
+        else if (arg == "--prune-bound" && i + 1 < argc)
+        {
+            char *end;
+            pruneBound = strtod(argv[++i], &end);
+            if (*end || !(pruneBound >= 0))
+            {
+                cerr << "Bad --prune-bound: " << argv[i] << " (a log-likelihood difference, at least 0)" << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = max(1, atoi(argv[++i]));
+        else if (arg == "--serve" && i + 1 < argc)
+            servePath = argv[++i];
+        else if (arg == "--queue" && i + 1 < argc)
+            queue = max(1, atoi(argv[++i]));
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg == "--components")
+            components = true;
+        else if (arg == "--edit")
+            edit = true;
+        else if (arg == "--results" && i + 1 < argc)
+            resultsPath = argv[++i];
+        else if (arg == "--results-format" && i + 1 < argc)
+            resultsFormat = argv[++i];
+        else if (arg == "--export" && i + 1 < argc)
+            exportFormat = argv[++i];
+        else if (arg == "--output" && i + 1 < argc)
+            outputPath = argv[++i];
+        else if (arg == "--shard")
+            shard = true;
+        else if (arg == "--stats" && i + 1 < argc)
+            statsPath = argv[++i];
+        else if (arg == "--posteriors" && i + 1 < argc)
+            posteriorsPath = argv[++i];
+        else if (arg == "--significance" && i + 1 < argc)
+            significance.replicates = max(0, atoi(argv[++i]));
+        else if (arg == "--significance-seed" && i + 1 < argc)
+            significance.seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--traits" && i + 1 < argc)
+            traitsPath = argv[++i];
+        else if (arg == "--trait-columns" && i + 1 < argc)
+        {
+            string text = argv[++i];
+            int used = 0;
+            traitCount = 0;
+            int fields = sscanf(text.c_str(), "%d%n,%d%n", &traitFirst, &used, &traitCount, &used);
+            if (fields < 1 || used != (int)text.size() || traitFirst < 1 || (fields == 2 && traitCount < 1))
+            {
+                cerr << "Bad --trait-columns: " << text << " (first[,count], both from 1)" << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--sweep" && i + 1 < argc)
+            sweepPath = argv[++i];
+        else if ((arg == "--sweep-q" || arg == "--sweep-penetrance" || arg == "--sweep-phenocopy") && i + 1 < argc)
+        {
+            vector<double> &axis = arg == "--sweep-q" ? grid.alleleFreq
+                                   : arg == "--sweep-penetrance" ? grid.penetrance
+                                                                 : grid.phenocopy;
+            if (!ParseSweepAxis(argv[++i], axis, arg == "--sweep-q"))
+            {
+                cerr << "Bad " << arg << " list: " << argv[i] << " (values must be in [0, 1]"
+                     << (arg == "--sweep-q" ? " or uniform)" : ")") << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--sweep-memory" && i + 1 < argc)
+            sweepMemory = max(1, atoi(argv[++i]));
+        else if (arg == "--help" || arg == "-h")
+        {
+            PrintUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "Unknown option: " << arg << endl;
+            PrintUsage(argv[0]);
+            return 1;
+        }
     }
-    return prob;
-}
-
-double DaughtersAffectionProb(int mother, double AffProb)
-{
-    double prob = 1.0;
-    for (int i = 0; i < Children[mother].size(); i++)
+    if (inputFormat.size() && inputFormat != "ped" && inputFormat != "csv")
     {
-        int Child = Children[mother][i];
-        if (gender[Child])
-            prob *= ((AffectionFile[Child] * AffProb) + (!AffectionFile[Child] * (1 - AffProb)));
+        cerr << "Unknown input format: " << inputFormat << endl;
+        return 1;
     }
-    return prob;
-}
-
-double SonsAffectionProb(int mother, double AffProb)
-{
-    double prob = 1.0;
-    for (int i = 0; i < Children[mother].size(); i++)
+    if (resultsFormat != "tsv" && resultsFormat != "json")
     {
-        int Child = Children[mother][i];
-        if (!gender[Child])
-            prob *= ((AffectionFile[Child] * AffProb) + (!AffectionFile[Child] * (1 - AffProb)));
+        cerr << "Unknown results format: " << resultsFormat << endl;
+        return 1;
+    }
+    if (exportFormat != "dot" && exportFormat != "json" && exportFormat != "none")
+    {
+        cerr << "Unknown export format: " << exportFormat << endl;
+        return 1;
+    }
+    if (engineName != "forward" && engineName != "peeling" && engineName != "both" && engineName != "mcmc")
+    {
+        cerr << "Unknown engine: " << engineName << endl;
+        return 1;
+    }
+    if (outputPath.empty())
+        outputPath = exportFormat == "json" ? "pedigree.json" : "pedigree.dot";
+    if (batch && inputPath.empty())
+    {
+        cerr << "--batch needs --input" << endl;
+        return 1;
+    }
+    if (snapshotPath.size() && (inputPath.size() || batch))
+    {
+        cerr << "--snapshot replaces --input and works on a single pedigree" << endl;
+        return 1;
+    }
+    if (batch && saveSnapshotPath.size())
+    {
+        cerr << "--save-snapshot works on a single pedigree, not with --batch" << endl;
+        return 1;
+    }
+    if (batch && sweepPath.size())
+    {
+        cerr << "--sweep works on a single pedigree, not with --batch" << endl;
+        return 1;
+    }
+    if (traitsPath.size() && (batch || snapshotPath.size() || inputPath.empty()))
+    {
+        cerr << "--traits reads the affection columns of a single --input pedigree" << endl;
+        return 1;
+    }
+    if (traitFirst && traitsPath.empty())
+    {
+        cerr << "--trait-columns only picks the columns of --traits" << endl;
+        return 1;
+    }
+    if (batch && posteriorsPath.size())
+    {
+        cerr << "--posteriors works on a single pedigree, not with --batch" << endl;
+        return 1;
+    }
+    if (batch && significance.replicates)
+    {
+        cerr << "--significance works on a single pedigree, not with --batch" << endl;
+        return 1;
+    }
+    if (significance.replicates && engineName != "forward")
+    {
+        cerr << "--significance re-scores replicates with the forward pass and needs --engine forward" << endl;
+        return 1;
+    }
+    if (components && (batch || edit || servePath.size()))
+    {
+        cerr << "--components splits a single pedigree; --batch and --serve already take families one by one," << endl
+             << "and --edit needs the pedigree analysed whole" << endl;
+        return 1;
+    }
+    if (components && engineName != "forward" && engineName != "both")
+    {
+        cerr << "--components runs the forward pass per family and needs --engine forward or both" << endl;
+        return 1;
+    }
+    if (batch && engineName == "both")
+    {
+        cerr << "--engine both works on a single pedigree; use forward or peeling with --batch" << endl;
+        return 1;
+    }
+    if (servePath.size() && (batch || inputPath.size() || snapshotPath.size() || saveSnapshotPath.size() || edit ||
+                             sweepPath.size() || posteriorsPath.size() || significance.replicates || traitsPath.size()))
+    {
+        cerr << "--serve reads its pedigrees from requests; it takes no --input, --batch, --snapshot," << endl
+             << "--save-snapshot, --edit, --sweep, --posteriors, --significance or --traits" << endl;
+        return 1;
+    }
+    if (servePath.size() && engineName == "both")
+    {
+        cerr << "--engine both works on a single pedigree; use forward, peeling or mcmc with --serve" << endl;
+        return 1;
+    }
+    if (edit && engineName != "forward")
+    {
+        cerr << "--edit updates the forward pass incrementally and needs --engine forward" << endl;
+        return 1;
     }
-    return prob;
-}
-
-double ADModelProb(int mother)
-{
-    int father = Partner[mother];
-    double Possibility[9];
-    double answer = 0;
-
-    // DD , DD -> All Children Affected.
-    Possibility[0] = Gene_Prob[mother][0][0] * Gene_Prob[father][0][0];
-    Possibility[0] *= ChildrenAffectionProb(mother, 1);
-
-    // DD , DR -> All Children Affected.
-    Possibility[1] = Gene_Prob[mother][0][0] * Gene_Prob[father][0][1];
-    Possibility[1] *= ChildrenAffectionProb(mother, 1);
-
-    // DD , RR -> All Children Affected.
-    Possibility[2] = Gene_Prob[mother][0][0] * Gene_Prob[father][0][2];
-    Possibility[2] *= ChildrenAffectionProb(mother, 1);
-
-    // DR , DD -> All Children Affected.
-    Possibility[3] = Gene_Prob[mother][0][1] * Gene_Prob[father][0][0];
-    Possibility[3] *= ChildrenAffectionProb(mother, 1);
-
-    // DR , DR -> 3/4 Of Children Affected.
-    Possibility[4] = Gene_Prob[mother][0][1] * Gene_Prob[father][0][1];
-    Possibility[4] *= ChildrenAffectionProb(mother, 0.75);
-
-    // DR , RR -> 1/2 Of Chidren Affected.
-    Possibility[5] = Gene_Prob[mother][0][1] * Gene_Prob[father][0][2];
-    Possibility[5] *= ChildrenAffectionProb(mother, 0.5);
-
-    // RR , DD -> All Chidren Affected.
-    Possibility[6] = Gene_Prob[mother][0][2] * Gene_Prob[father][0][0];
-    Possibility[6] *= ChildrenAffectionProb(mother, 1);
-
-    // RR , DR -> 1/2 Of Chidren Affected.
-    Possibility[7] = Gene_Prob[mother][0][2] * Gene_Prob[father][0][1];
-    Possibility[7] *= ChildrenAffectionProb(mother, 0.5);
-
-    // RR , RR -> None Of Chidren Affected.
-    Possibility[8] = Gene_Prob[mother][0][2] * Gene_Prob[father][0][2];
-    Possibility[8] *= ChildrenAffectionProb(mother, 0);
-
-    for (int i = 0; i < 9; i++)
-        answer += Possibility[i];
-    return answer;
-}
-
-double ARModelProb(int mother)
-{
-    int father = Partner[mother];
-    double Possibility[9];
-    double answer = 0;
-
-    // DD , DD -> None of Children Affected.
-    Possibility[0] = Gene_Prob[mother][1][0] * Gene_Prob[father][1][0];
-    Possibility[0] *= ChildrenAffectionProb(mother, 0);
-
-    // DD , DR -> None of Children Affected.
-    Possibility[1] = Gene_Prob[mother][1][0] * Gene_Prob[father][1][1];
-    Possibility[1] *= ChildrenAffectionProb(mother, 0);
-
-    // DD , RR -> None of Children Affected.
-    Possibility[2] = Gene_Prob[mother][1][0] * Gene_Prob[father][1][2];
-    Possibility[2] *= ChildrenAffectionProb(mother, 0);
-
-    // DR , DD -> None of Children Affected.
-    Possibility[3] = Gene_Prob[mother][1][1] * Gene_Prob[father][1][0];
-    Possibility[3] *= ChildrenAffectionProb(mother, 0);
-
-    // DR , DR -> 1/4 Of Children Affected.
-    Possibility[4] = Gene_Prob[mother][1][1] * Gene_Prob[father][1][1];
-    Possibility[4] *= ChildrenAffectionProb(mother, 0.25);
-
-    // DR , RR -> 1/2 Of Chidren Affected.
-    Possibility[5] = Gene_Prob[mother][1][1] * Gene_Prob[father][1][2];
-    Possibility[5] *= ChildrenAffectionProb(mother, 0.5);
 
-    // RR , DD -> None of Chidren Affected.
-    Possibility[6] = Gene_Prob[mother][1][2] * Gene_Prob[father][1][0];
-    Possibility[6] *= ChildrenAffectionProb(mother, 0);
+    ThreadPool pool(threads);
+    PedigreeStats statistics;
+    PedigreeStats *stats = statsPath.size() ? &statistics : nullptr;
+    StatsReport report{statsPath, &statistics, &pool};
+    if (stats)
+    {
+        pool.trackBusyTime();
+        heapCounting = true;
+    }
+    unique_ptr<FamilyCache> cache;
+    if (cacheMemory)
+        cache = make_unique<FamilyCache>(cacheMemory << 20);
+    if (servePath.size())
+    {
+        ServerOptions options;
+        options.endpoint = servePath;
+        options.workers = threads;
+        options.queue = queue;
+        options.engine = engineName;
+        options.mcmc = mcmc;
+        options.pruneBound = pruneBound;
+        options.cache = cache.get();
+        options.stats = stats;
+        int status = RunServer(options);
+        ReportCache(cache.get(), stats);
+        return status;
+    }
+    if (batch)
+        return RunBatch(inputPath, inputFormat, resultsPath, resultsFormat == "json", engineName, mcmc, pruneBound, cache.get(),
+                        pool, stats);
 
-    // RR , DR -> 1/2 Of Chidren Affected.
-    Possibility[7] = Gene_Prob[mother][1][2] * Gene_Prob[father][1][1];
-    Possibility[7] *= ChildrenAffectionProb(mother, 0.5);
+    // Getting the input pedigree...
+    PedigreeEngine engine;
+    engine.setThreadPool(&pool);
+    engine.setStats(stats);
+    engine.setCache(cache.get());
+    engine.setPruneBound(pruneBound);
+    string error;
+    {
+        PhaseTimer timer(stats, PhaseInput);
+        if (snapshotPath.size() || inputPath.size())
+        {
+            if (snapshotPath.size() ? !engine.loadSnapshot(snapshotPath, error)
+                                    : !engine.load(inputPath, inputFormat, error))
+            {
+                cerr << "Error: " << error << endl;
+                return 1;
+            }
+            if (traitsPath.size() && !engine.loadTraits(inputFormat, traitFirst, traitCount, error))
+            {
+                cerr << "Error: " << error << endl;
+                return 1;
+            }
+        }
+        else
+            engine.loadInteractive();
+    }
+    if (stats)
+    {
+        stats->families = 1;
+        stats->people = engine.size();
+    }
 
-    // RR , RR -> All Chidren Affected.
-    Possibility[8] = Gene_Prob[mother][1][2] * Gene_Prob[father][1][2];
-    Possibility[8] *= ChildrenAffectionProb(mother, 1);
+    if (exportFormat != "none")
+    {
+        PhaseTimer timer(stats, PhaseExport);
+        if (!engine.exportGraph(outputPath, exportFormat == "json" ? ExportJson : ExportDot, shard, error))
+            cerr << "Error: " << error << endl;
+    }
 
-    for (int i = 0; i < 9; i++)
-        answer += Possibility[i];
-    return answer;
-}
+    // Gene Probability Calculation
+    double forward[5], forwardSeconds = 0, peelSeconds = 0, sampleSeconds = 0;
+    bool compare = false;
+    McmcReport mcmcReport;
+    vector<ComponentResult> componentResults;
+    if (engineName == "forward" || engineName == "both")
+    {
+        auto start = chrono::steady_clock::now();
+        if (components)
+        {
+            engine.analyzeComponents(componentResults);
+            if (stats)
+                stats->families = componentResults.size();
+            // What needs the whole pedigree's schedule still gets it.
+            if (saveSnapshotPath.size() || sweepPath.size() || significance.replicates || traitsPath.size())
+                engine.prepare();
+        }
+        else
+            engine.analyze();
+        forwardSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        copy(engine.logLikelihoods(), engine.logLikelihoods() + 5, forward);
+        ReportCache(cache.get(), stats);
+        ReportPruning(engine, pruneBound);
+    }
+    else if (saveSnapshotPath.size() || sweepPath.size() || traitsPath.size())
+        engine.prepare(); // The snapshot carries the forward schedule, and --sweep and --traits run it.
+    if (engineName == "mcmc")
+    {
+        auto start = chrono::steady_clock::now();
+        if (!engine.sample(mcmc, mcmcReport, error))
+        {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+        sampleSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    if (engineName == "peeling" || engineName == "both")
+    {
+        auto start = chrono::steady_clock::now();
+        if (engine.peel(error))
+            compare = engineName == "both";
+        else
+        {
+            cerr << "Error: " << error << endl;
+            if (engineName == "peeling")
+                return 1;
+        }
+        peelSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    if (saveSnapshotPath.size())
+    {
+        PhaseTimer timer(stats, PhaseExport);
+        if (!engine.saveSnapshot(saveSnapshotPath, error))
+            cerr << "Error: " << error << endl;
+    }
 
-double XLDModeProbe(int mother)
-{
-    int father = Partner[mother];
-    double Possibility[6];
-    double answer = 0;
-
-    // XdXd , XdY -> ALl Children Affected.
-    Possibility[0] = Gene_Prob[mother][2][3] * Gene_Prob[father][2][3];
-    Possibility[0] *= ChildrenAffectionProb(mother, 1);
-
-    // XdXd , XrY -> All Children Affected.
-    Possibility[1] = Gene_Prob[mother][2][3] * Gene_Prob[father][2][4];
-    Possibility[1] *= ChildrenAffectionProb(mother, 1);
-
-    // XdXr , XdY -> All Daughters Affected,
-    //               1/2 of Sons Affected.
-    Possibility[2] = Gene_Prob[mother][2][4] * Gene_Prob[father][2][3];
-    Possibility[2] *= DaughtersAffectionProb(mother, 1);
-    Possibility[2] *= SonsAffectionProb(mother, 0.5);
-
-    // XdXr , XrY -> 1/2 of Daughters Affected,
-    //               1/2 of Sons Affected.
-    Possibility[3] = Gene_Prob[mother][2][4] * Gene_Prob[father][2][4];
-    Possibility[3] *= DaughtersAffectionProb(mother, 0.5);
-    Possibility[3] *= SonsAffectionProb(mother, 0.5);
-    // XrXr , XdY -> All Daughters Affected,
-    //               None of Sons Affected.
-    Possibility[4] = Gene_Prob[mother][2][5] * Gene_Prob[father][2][3];
-    Possibility[4] *= DaughtersAffectionProb(mother, 1);
-    Possibility[4] *= SonsAffectionProb(mother, 0);
-
-    // XrXr , XrY -> None of Daughters Affected,
-    //               None of Sons Affected.
-    Possibility[5] = Gene_Prob[mother][2][5] * Gene_Prob[father][2][4];
-    Possibility[5] *= DaughtersAffectionProb(mother, 0);
-    Possibility[5] *= SonsAffectionProb(mother, 0);
-
-    for (int i = 0; i < 6; i++)
-        answer += Possibility[i];
-    return answer;
-}
+    {
+        PhaseTimer timer(stats, PhaseOutput);
+        PrintReport(engine);
+        if (components)
+            PrintComponents(engine, componentResults);
+        if (compare)
+            PrintComparison(forward, engine.logLikelihoods(), forwardSeconds, peelSeconds);
+        if (engineName == "mcmc")
+            PrintMcmcReport(engine.logLikelihoods(), mcmcReport, sampleSeconds);
+    }
+    if (significance.replicates)
+    {
+        auto start = chrono::steady_clock::now();
+        SignificanceReport significanceReport;
+        engine.significance(significance, significanceReport);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        PrintSignificance(engine, significance, significanceReport, seconds);
+    }
+    if (posteriorsPath.size() && RunPosteriors(engine, posteriorsPath))
+        return 1;
+    if (traitsPath.size() && RunTraits(engine, traitsPath, sweepMemory << 20))
+        return 1;
+    if (sweepPath.size() && RunSweep(engine, grid, sweepPath, sweepMemory << 20))
+        return 1;
+    if (edit)
+        RunEditLoop(engine, stats);
 
-double XLRModeProbe(int mother)
-{
-    int father = Partner[mother];
-    double Possibility[6];
-    double answer = 0;
-
-    // XdXd , XdY -> None of Children Affected.
-    Possibility[0] = Gene_Prob[mother][3][3] * Gene_Prob[father][3][3];
-    Possibility[0] *= ChildrenAffectionProb(mother, 0);
-
-    // XdXd , XrY -> None of Children Affected.
-    Possibility[1] = Gene_Prob[mother][3][3] * Gene_Prob[father][3][4];
-    Possibility[1] *= ChildrenAffectionProb(mother, 0);
-
-    // XdXr , XdY -> None of Daughters Affected,
-    //               1/2 of Sons Affected.
-    Possibility[2] = Gene_Prob[mother][3][4] * Gene_Prob[father][3][3];
-    Possibility[2] *= DaughtersAffectionProb(mother, 0);
-    Possibility[2] *= SonsAffectionProb(mother, 0.5);
-
-    // XdXr , XrY -> 1/2 of Daughters Affected,
-    //               1/2 of Sons Affected.
-    Possibility[3] = Gene_Prob[mother][3][4] * Gene_Prob[father][3][4];
-    Possibility[3] *= DaughtersAffectionProb(mother, 0.5);
-    Possibility[3] *= SonsAffectionProb(mother, 0.5);
-
-    // XrXr , XdY -> None of Daughters Affected,
-    //               ALl Sons Affected.
-    Possibility[4] = Gene_Prob[mother][3][5] * Gene_Prob[father][3][3];
-    Possibility[4] *= DaughtersAffectionProb(mother, 0);
-    Possibility[4] *= SonsAffectionProb(mother, 1);
-
-    // XrXr , XrY -> All Children Affected.
-    Possibility[5] = Gene_Prob[mother][3][5] * Gene_Prob[father][3][4];
-    Possibility[5] *= ChildrenAffectionProb(mother, 1);
-
-    for (int i = 0; i < 6; i++)
-        answer += Possibility[i];
-    return answer;
+    return 0;
 }
-
-double YLModeProbe(int mother)
-{
-    int father = Partner[mother];
-    double Possibility[2];
-
-    // No Woman Has it.
-    if (AffectionFile[mother])
-        return 0;
-    double answer = 0;
-
-    // XY* -> All Sons Affected.
-    Possibility[0] = Gene_Prob[father][4][5];
-    Possibility[0] *= SonsAffectionProb(mother, 1);
-
-    // XY -> None of Sons Affected.
-    Possibility[1] = Gene_Prob[father][4][6];
-    Possibility[1] *= SonsAffectionProb(mother, 0);
-
-    for (int i = 0; i < 2; i++)
-        answer += Possibility[i];
-
-    answer *= DaughtersAffectionProb(mother, 0);
-
-    return answer;
-}
\ No newline at end of file
@@ -0,0 +1,133 @@
+/*
+    Pedigree Analysis - a cache of nuclear-family results shared across analyses.
+    A mating's factors and its children's genes depend only on the parents' genes
+    and on how many affected / unaffected daughters and sons it has. Founders
+    start from a handful of fixed distributions and sibships are small, so over
+    thousands of pedigrees the same families come up again and again; the cache
+    keeps their results, keyed by exactly those inputs. It is bounded, least
+    recently used first out, and split into independently locked shards so the
+    batch workers can share it.
+*/
+
+#ifndef PEDIGREE_CACHE_H
+#define PEDIGREE_CACHE_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+const int familyGenes = 14; // Genes of one person over the five modes: 3 + 3 + 3 + 3 + 2.
+
+struct FamilyKey
+{
+    double mother[familyGenes], father[familyGenes];
+    int sibship[4]; // Affected / unaffected daughters, affected / unaffected sons.
+    int modes;      // The modes the pass still follows, bit per mode; the others' genes are zeros.
+    int unused = 0;
+
+    // Bitwise, so -0.0 and 0.0 are different families; that only costs a miss.
+    bool operator==(const FamilyKey &other) const { return !memcmp(this, &other, sizeof(FamilyKey)); }
+};
+
+struct FamilyKeyHash
+{
+    size_t operator()(const FamilyKey &key) const
+    {
+        uint64_t words[sizeof(FamilyKey) / 8];
+        memcpy(words, &key, sizeof(words));
+        uint64_t hash = 0x9e3779b97f4a7c15ull;
+        for (uint64_t word : words)
+        {
+            hash ^= word;
+            hash *= 0xff51afd7ed558ccdull;
+            hash ^= hash >> 32;
+        }
+        return hash;
+    }
+};
+
+struct FamilyResult
+{
+    array<double, 5> factor;               // The mating's log factor per mode.
+    double children[4][familyGenes] = {}; // A child's genes, by [female * 2 + affected].
+};
+
+class FamilyCache
+{
+public:
+    // Room for about `bytes` worth of families.
+    explicit FamilyCache(size_t bytes, int shards = 64) : shards(new Shard[shards]), shardCount(shards)
+    {
+        size_t entry = sizeof(FamilyKey) + sizeof(FamilyResult) + 64; // List and index overhead, roughly.
+        perShard = max<size_t>(1, bytes / entry / shards);
+    }
+
+    bool find(const FamilyKey &key, FamilyResult &result)
+    {
+        size_t hash = FamilyKeyHash()(key);
+        Shard &shard = shards[hash % shardCount];
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.index.find(key);
+        if (found == shard.index.end())
+        {
+            shard.misses++;
+            return false;
+        }
+        shard.hits++;
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        result = found->second->second;
+        return true;
+    }
+
+    void insert(const FamilyKey &key, const FamilyResult &result)
+    {
+        size_t hash = FamilyKeyHash()(key);
+        Shard &shard = shards[hash % shardCount];
+        lock_guard<mutex> guard(shard.lock);
+        if (shard.index.count(key)) // Another worker got there first.
+            return;
+        if (shard.entries.size() >= perShard)
+        {
+            shard.index.erase(shard.entries.back().first);
+            shard.entries.pop_back();
+            shard.evictions++;
+        }
+        shard.entries.emplace_front(key, result);
+        shard.index.emplace(key, shard.entries.begin());
+    }
+
+    // Totals over the shards; only exact once the workers are done.
+    long long hits() const { return total(&Shard::hits); }
+    long long misses() const { return total(&Shard::misses); }
+    long long evictions() const { return total(&Shard::evictions); }
+
+private:
+    struct Shard
+    {
+        mutex lock;
+        list<pair<FamilyKey, FamilyResult>> entries; // Most recently used first.
+        unordered_map<FamilyKey, list<pair<FamilyKey, FamilyResult>>::iterator, FamilyKeyHash> index;
+        long long hits = 0, misses = 0, evictions = 0;
+    };
+
+    long long total(long long Shard::*counter) const
+    {
+        long long sum = 0;
+        for (int i = 0; i < shardCount; i++)
+            sum += shards[i].*counter;
+        return sum;
+    }
+
+    unique_ptr<Shard[]> shards;
+    int shardCount;
+    size_t perShard;
+};
+
+#endif
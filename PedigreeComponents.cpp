@@ -0,0 +1,90 @@
+/*
+    Pedigree Analysis - disjoint families analysed apart.
+    A registry file often holds many families that share nobody. As one
+    pedigree they still go through one schedule, whose waves mix everybody's
+    founders and matings. Split into connected components (people joined by
+    parenthood or partnership), every family becomes a small pedigree of its
+    own, renumbered from 0 so its arrays stay small and close together, and
+    the families can be analysed side by side. No factor spans two families,
+    so the log-likelihood of the whole is the sum over them.
+*/
+
+#include "PedigreeEngine.h"
+
+// People of `from`, renumbered: local[p] is p's index among them.
+void PedigreeEngine::LoadComponent(const PedigreeEngine &from, const int *people, int count, const vector<int> &local)
+{
+    AllocatePedigree(count);
+    gender.resize(count);
+    AffectionFile.resize(count);
+    Parents.resize(count);
+    PersonID.resize(count);
+    auto map = [&local](int p) { return p < 0 ? -1 : local[p]; };
+    for (int i = 0; i < count; i++)
+    {
+        int p = people[i];
+        gender[i] = from.gender[p];
+        AffectionFile[i] = from.AffectionFile[p];
+        PersonID[i] = from.PersonID[p]; // Views into `from`, which outlives this engine's use of them.
+        Parents[i] = {map(from.Parents[p].first), map(from.Parents[p].second)};
+        Partner[i] = map(from.Partner[p]);
+        if (Parents[i].first == -1)
+            Headers.push_back(i);
+    }
+    BuildMatings();
+}
+
+/*
+    Families no bigger than a thread's share of the people go to the pool one
+    whole family per task, each on an engine that thread reuses. A larger one
+    would leave the other threads idle, so it is analysed first on the calling
+    thread, with the pool running its waves as usual.
+*/
+void PedigreeEngine::analyzeComponents(vector<ComponentResult> &results)
+{
+    vector<int> componentStart, members;
+    int count = FindComponents(componentStart, members);
+    vector<int> local(numOfPeople);
+    for (int c = 0; c < count; c++)
+        for (int k = componentStart[c]; k < componentStart[c + 1]; k++)
+            local[members[k]] = k - componentStart[c];
+
+    int threads = Pool ? Pool->size() : 1;
+    vector<PedigreeEngine> engines(threads);
+    for (PedigreeEngine &engine : engines)
+    {
+        engine.setStats(Stats);
+        engine.setCache(Cache);
+        engine.setPruneBound(PruneBound);
+    }
+    results.assign(count, ComponentResult());
+    auto analyzeOne = [&](PedigreeEngine &engine, int c) {
+        int size = componentStart[c + 1] - componentStart[c];
+        engine.LoadComponent(*this, &members[componentStart[c]], size, local);
+        engine.analyze();
+        results[c].first = members[componentStart[c]];
+        results[c].people = size;
+        copy(engine.Model_Prob, engine.Model_Prob + 5, results[c].logLikelihood);
+    };
+    auto large = [&](int c) { return threads > 1 && (componentStart[c + 1] - componentStart[c]) * threads > numOfPeople; };
+
+    engines[0].setThreadPool(Pool);
+    for (int c = 0; c < count; c++)
+        if (large(c))
+            analyzeOne(engines[0], c);
+    engines[0].setThreadPool(nullptr);
+    parallelFor(count, 4, [&](int begin, int end) {
+        PedigreeEngine &engine = engines[Pool ? ThreadPool::threadIndex() : 0];
+        for (int c = begin; c < end; c++)
+            if (!large(c))
+                analyzeOne(engine, c);
+    });
+
+    // Summed in family order, whatever the thread count.
+    for (int mode = 0; mode < 5; mode++)
+    {
+        Model_Prob[mode] = 0;
+        for (const ComponentResult &result : results)
+            Model_Prob[mode] += result.logLikelihood[mode];
+    }
+}
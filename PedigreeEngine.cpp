@@ -0,0 +1,1292 @@
+/*
+    Pedigree Analysis - the analysis engine.
+*/
+
+#include "PedigreeEngine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Everything per person is sized to the pedigree, nothing is preallocated.
+void PedigreeEngine::AllocatePedigree(int n)
+{
+    numOfPeople = n;
+    ScheduleLoaded = false;
+    gender.clear();
+    AffectionFile.clear();
+    TraitNames.clear();
+    TraitBits.clear();
+    Parents.clear();
+    PersonID.clear();
+    Headers.clear();
+    OwnedIDs.clear();
+    Partner.assign(n, -1);
+    FounderFactor.assign(n, array<double, 5>());
+    for (int mode = 0; mode < 5; mode++)
+        Gene_Prob[mode].assign((size_t)n * modeStates[mode], 0);
+}
+
+/*
+    The mating table. Declared couples come first, in the order of their first
+    member, then any other couple that has a child, in the order of that child;
+    offspring are listed per mating in input order.
+*/
+void PedigreeEngine::BuildMatings()
+{
+    int n = numOfPeople;
+    Matings.clear();
+    BirthMating.assign(n, -1);
+    // Each mother's matings as a list, so a couple is found without a hash table.
+    vector<int> &firstMating = Scratch[0], &nextMating = Scratch[1], &fill = Scratch[2];
+    firstMating.assign(n, -1);
+    nextMating.clear();
+    auto addMating = [&](int mother, int father) {
+        int last = -1;
+        for (int id = firstMating[mother]; id != -1; last = id, id = nextMating[id])
+            if (Matings[id].father == father)
+                return id;
+        (last == -1 ? firstMating[mother] : nextMating[last]) = Matings.size();
+        Matings.push_back({mother, father});
+        nextMating.push_back(-1);
+        return (int)Matings.size() - 1;
+    };
+    for (int i = 0; i < n; i++)
+    {
+        int partner = Partner[i];
+        if (partner != -1 && gender[i] != gender[partner])
+            addMating(gender[i] ? i : partner, gender[i] ? partner : i);
+    }
+    for (int i = 0; i < n; i++)
+        if (Parents[i].first != -1)
+            BirthMating[i] = addMating(Parents[i].first, Parents[i].second);
+
+    int m = Matings.size();
+    OffspringStart.assign(m + 1, 0);
+    for (int i = 0; i < n; i++)
+        if (BirthMating[i] != -1)
+            OffspringStart[BirthMating[i] + 1]++;
+    for (int k = 0; k < m; k++)
+        OffspringStart[k + 1] += OffspringStart[k];
+    Offspring.resize(OffspringStart[m]);
+    fill.assign(OffspringStart.begin(), OffspringStart.end() - 1);
+    for (int i = 0; i < n; i++)
+        if (BirthMating[i] != -1)
+            Offspring[fill[BirthMating[i]]++] = i;
+
+    // Matings of each person, flattened.
+    PersonMatingStart.assign(n + 1, 0);
+    PersonMatings.resize(2 * m);
+    for (const Mating &mating : Matings)
+    {
+        PersonMatingStart[mating.mother + 1]++;
+        PersonMatingStart[mating.father + 1]++;
+    }
+    for (int i = 0; i < n; i++)
+        PersonMatingStart[i + 1] += PersonMatingStart[i];
+    fill.assign(PersonMatingStart.begin(), PersonMatingStart.end() - 1);
+    for (int k = 0; k < m; k++)
+    {
+        PersonMatings[fill[Matings[k].mother]++] = k;
+        PersonMatings[fill[Matings[k].father]++] = k;
+    }
+}
+
+// The mating of mother and father, or -1.
+int PedigreeEngine::FindMating(int mother, int father) const
+{
+    for (int k = PersonMatingStart[mother]; k < PersonMatingStart[mother + 1]; k++)
+        if (Matings[PersonMatings[k]].mother == mother && Matings[PersonMatings[k]].father == father)
+            return PersonMatings[k];
+    return -1;
+}
+
+int PedigreeEngine::ChildCount(int person) const
+{
+    int children = 0;
+    for (int k = PersonMatingStart[person]; k < PersonMatingStart[person + 1]; k++)
+        children += OffspringStart[PersonMatings[k] + 1] - OffspringStart[PersonMatings[k]];
+    return children;
+}
+
+void PedigreeEngine::CountSibships()
+{
+    Sibships.assign(Matings.size(), Sibship());
+    for (int i = 0; i < numOfPeople; i++)
+    {
+        if (BirthMating[i] == -1)
+            continue;
+        Sibship &sibs = Sibships[BirthMating[i]];
+        if (gender[i])
+            (AffectionFile[i] ? sibs.affectedDaughters : sibs.unaffectedDaughters)++;
+        else
+            (AffectionFile[i] ? sibs.affectedSons : sibs.unaffectedSons)++;
+    }
+}
+
+void InputBuffer::release()
+{
+    if (mapping)
+        munmap(mapping, size);
+    mapping = nullptr;
+    owned.clear();
+    data = nullptr;
+    size = 0;
+}
+
+bool ReadInput(const string &path, InputBuffer &Input, string &error)
+{
+    Input.release();
+    int fd = (path == "-") ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    // Regular files are mapped, so the tokenizer works on the page cache directly.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            Input.mapping = mapping;
+            Input.data = (const char *)mapping;
+            Input.size = st.st_size;
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return true;
+        }
+    }
+
+    // Pipes can't be mapped: read them in big chunks instead.
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        Input.owned.append(chunk, n);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    if (n < 0)
+    {
+        error = "cannot read " + path + ": " + strerror(errno);
+        return false;
+    }
+    Input.data = Input.owned.data();
+    Input.size = Input.owned.size();
+    return true;
+}
+
+static string_view Trim(string_view s)
+{
+    while (s.size() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r'))
+        s.remove_prefix(1);
+    while (s.size() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+        s.remove_suffix(1);
+    return s;
+}
+
+static bool IsMissing(string_view s)
+{
+    return s.empty() || s == "0" || s == "." || s == "-9" || s == "NA";
+}
+
+// Splits one line into at most maxFields fields, without copying.
+static int SplitFields(string_view line, bool csv, string_view *fields, int maxFields)
+{
+    int count = 0;
+    size_t pos = 0;
+    while (count < maxFields && pos <= line.size())
+    {
+        if (csv)
+        {
+            size_t comma = line.find(',', pos);
+            if (comma == string_view::npos)
+                comma = line.size();
+            fields[count++] = Trim(line.substr(pos, comma - pos));
+            pos = comma + 1;
+        }
+        else
+        {
+            while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r'))
+                pos++;
+            if (pos >= line.size())
+                break;
+            size_t end = pos;
+            while (end < line.size() && line[end] != ' ' && line[end] != '\t' && line[end] != '\r')
+                end++;
+            fields[count++] = line.substr(pos, end - pos);
+            pos = end;
+        }
+    }
+    return count;
+}
+
+// CSV unless the format says otherwise or the first line has no comma.
+static bool IsCsv(string_view text, const string &format)
+{
+    if (format.size())
+        return format == "csv";
+    return text.substr(0, text.find('\n')).find(',') != string_view::npos;
+}
+
+static bool ParseAffection(string_view affection, bool csv, bool &affected)
+{
+    if (csv ? affection == "1" : affection == "2")
+        affected = true;
+    else if (csv ? affection == "0" : (affection == "1" || IsMissing(affection)))
+        affected = false;
+    else
+        return false;
+    return true;
+}
+
+/*
+    Batch input. Two layouts are accepted, one person per line:
+    PED/LINKAGE (whitespace separated):
+        family  id  father  mother  sex(1 = Male, 2 = Female)  affection(2 = Affected, 1 = Unaffected)
+    CSV (an optional "id,..." header line is skipped):
+        id, mother, father, sex(F/M or 1 if Female / 0 if Male), affection(1 / 0), partner
+    Missing parents / partners are 0, ".", "NA" or empty. Lines starting with '#' are comments.
+    PED has no partner column: partners are taken from the parents of each child.
+*/
+bool ParseRows(string_view text, const string &format, vector<InputRow> &rows, vector<string_view> &families, string &error)
+{
+    bool csv = IsCsv(text, format);
+    rows.clear();
+    rows.reserve(count(text.begin(), text.end(), '\n') + 1);
+    families.clear();
+    unordered_map<string_view, int> familyIndex;
+
+    int lineNo = 0;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find('\n', pos);
+        if (end == string_view::npos)
+            end = text.size();
+        string_view line = Trim(text.substr(pos, end - pos));
+        pos = end + 1;
+        lineNo++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        string_view field[6];
+        int n = SplitFields(line, csv, field, 6);
+        InputRow row;
+        row.line = lineNo;
+        string_view sex, affection;
+        if (csv)
+        {
+            if (rows.empty() && (field[0] == "id" || field[0] == "ID" || field[0] == "Id"))
+                continue;
+            if (n < 5)
+            {
+                error = "line " + to_string(lineNo) + ": expected id,mother,father,sex,affection[,partner]";
+                return false;
+            }
+            row.family = 0;
+            row.id = field[0];
+            row.mother = field[1];
+            row.father = field[2];
+            sex = field[3];
+            affection = field[4];
+            row.partner = n > 5 ? field[5] : string_view();
+        }
+        else
+        {
+            if (n < 6)
+            {
+                error = "line " + to_string(lineNo) + ": expected family id father mother sex affection";
+                return false;
+            }
+            auto family = familyIndex.try_emplace(field[0], (int)families.size());
+            if (family.second)
+                families.push_back(field[0]);
+            row.family = family.first->second;
+            row.id = field[1];
+            row.father = field[2];
+            row.mother = field[3];
+            sex = field[4];
+            affection = field[5];
+        }
+
+        if (csv ? (sex == "F" || sex == "f" || sex == "1") : sex == "2")
+            row.female = 1;
+        else if (csv ? (sex == "M" || sex == "m" || sex == "0") : sex == "1")
+            row.female = 0;
+        else
+        {
+            error = "line " + to_string(lineNo) + ": unknown sex '" + string(sex) + "'";
+            return false;
+        }
+
+        bool affected;
+        if (ParseAffection(affection, csv, affected))
+            row.affected = affected;
+        else
+        {
+            error = "line " + to_string(lineNo) + ": unknown affection status '" + string(affection) + "'";
+            return false;
+        }
+        rows.push_back(row);
+    }
+    if (csv)
+        families.push_back("1");
+
+    return true;
+}
+
+/*
+    The traits of the text ParseRows() made rows from: the affection column,
+    then the columns first .. first + count - 1, numbered from 1 as in the file
+    (count 0: through the last column, every row as wide as the first). Without
+    a first, a CSV file with a header line has every column after partner as a
+    trait; any other column past the affection (PED) or partner (CSV) column is
+    refused, since LINKAGE PED files carry marker genotypes coded 1/2 there that
+    would read as affections. Bit t of row r is bits[r * words + t / 64] >> t % 64,
+    words = (traits + 63) / 64. Names come from a CSV header line, otherwise
+    they are trait1, trait2, ...
+*/
+bool ParseTraits(string_view text, const string &format, int first, int count, const vector<InputRow> &rows,
+                 vector<string> &names, vector<uint64_t> &bits, string &error)
+{
+    bool csv = IsCsv(text, format);
+    names.clear();
+    bits.clear();
+    if (rows.empty())
+        return true;
+    const int fixed = 6; // Columns before the first extra one: up to affection (PED) or partner (CSV).
+    if (first && first <= fixed)
+    {
+        error = "trait column " + to_string(first) + " is not after the " + (csv ? "partner" : "affection") +
+                " column (" + to_string(fixed) + ")";
+        return false;
+    }
+
+    size_t pos = 0;
+    int lineNo = 0;
+    auto nextLine = [&]() {
+        size_t end = min(text.find('\n', pos), text.size());
+        string_view line = Trim(text.substr(pos, end - pos));
+        pos = end + 1;
+        lineNo++;
+        return line;
+    };
+
+    // The header is the only line before the first row that is neither blank nor a comment.
+    string_view header, line;
+    while (lineNo < rows[0].line)
+    {
+        line = nextLine();
+        if (lineNo < rows[0].line && line.size() && line[0] != '#')
+            header = line;
+    }
+    bool given = first;
+    if (!first && csv && header.size())
+        first = fixed + 1;
+    // The last column a row has: with a count, rows may have more.
+    vector<string_view> field(line.size() + 2);
+    int last = !first ? fixed : count ? first - 1 + count : SplitFields(line, csv, field.data(), field.size());
+    if (given && last < first)
+    {
+        error = "line " + to_string(rows[0].line) + ": no column " + to_string(first);
+        return false;
+    }
+    int traits = first ? max(1, last - first + 2) : 1;
+    int words = (traits + 63) / 64;
+    // The t-th trait's column.
+    auto column = [&](int t) { return t ? first - 2 + t : csv ? 4 : 5; };
+    field.resize(max(last, fixed) + 1); // One more than a row may have.
+    bits.assign(rows.size() * words, 0);
+
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        while (lineNo < rows[r].line)
+            line = nextLine();
+        int n = SplitFields(line, csv, field.data(), field.size());
+        if (!first && n > fixed)
+        {
+            error = "line " + to_string(lineNo) + " has columns after the " + (csv ? "partner" : "affection") +
+                    " column: name the trait columns with --trait-columns" +
+                    (csv ? " or a header line" : " (marker genotypes are not traits)");
+            return false;
+        }
+        if (first && (count ? n < last : (n > fixed || last > fixed) && n != last))
+        {
+            error = "line " + to_string(lineNo) + ": expected " + to_string(last) + (count ? " or more" : "") +
+                    " columns, like line " + to_string(rows[0].line);
+            return false;
+        }
+        for (int t = 0; t < traits; t++)
+        {
+            bool affected;
+            if (!ParseAffection(field[column(t)], csv, affected))
+            {
+                error = "line " + to_string(lineNo) + ": unknown affection status '" + string(field[column(t)]) + "'";
+                return false;
+            }
+            bits[r * words + t / 64] |= (uint64_t)affected << t % 64;
+        }
+    }
+
+    int headerFields = 0;
+    if (csv && header.size())
+    {
+        field.resize(max<size_t>(field.size(), header.size() + 1));
+        headerFields = SplitFields(header, csv, field.data(), field.size());
+    }
+    for (int t = 0; t < traits; t++)
+        names.push_back(column(t) < headerFields && field[column(t)].size() ? string(field[column(t)])
+                                                                          : "trait" + to_string(t + 1));
+    return true;
+}
+
+// Gives every row its dense index: its position in rows.
+bool IndexRows(const vector<InputRow> &rows, PersonIndex &ids, string &error)
+{
+    ids.reserve(rows.size());
+    for (int i = 0; i < (int)rows.size(); i++)
+    {
+        if (IsMissing(rows[i].id) || !ids.insert(PersonKey{rows[i].family, rows[i].id}, i))
+        {
+            error = "line " + to_string(rows[i].line) + ": missing or duplicate id '" + string(rows[i].id) + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fills the pedigree from rows[begin, end); references must stay inside that range.
+bool PedigreeEngine::loadRows(const vector<InputRow> &rows, int begin, int end, const PersonIndex &ids, string &error)
+{
+    AllocatePedigree(end - begin);
+
+    auto resolve = [&](const InputRow &row, string_view id, const char *role, int &index) {
+        index = -1;
+        if (IsMissing(id))
+            return true;
+        int found = ids.find(PersonKey{row.family, id});
+        if (found < begin || found >= end)
+        {
+            error = "line " + to_string(row.line) + ": " + role + " '" + string(id) + "' is not in the pedigree";
+            return false;
+        }
+        index = found - begin;
+        return true;
+    };
+
+    gender.resize(numOfPeople);
+    AffectionFile.resize(numOfPeople);
+    Parents.resize(numOfPeople);
+    PersonID.resize(numOfPeople);
+    for (int i = 0; i < numOfPeople; i++)
+    {
+        const InputRow &row = rows[begin + i];
+        int mother, father, partner;
+        if (!resolve(row, row.mother, "mother", mother) || !resolve(row, row.father, "father", father) ||
+            !resolve(row, row.partner, "partner", partner))
+            return false;
+        if ((mother == -1) != (father == -1))
+        {
+            error = "line " + to_string(row.line) + ": '" + string(row.id) + "' needs both parents or none";
+            return false;
+        }
+
+        if ((mother != -1 && !rows[begin + mother].female) || (father != -1 && rows[begin + father].female))
+        {
+            error = "line " + to_string(row.line) + ": the mother of '" + string(row.id) +
+                    "' must be female and the father male";
+            return false;
+        }
+
+        gender[i] = row.female;
+        AffectionFile[i] = row.affected;
+        PersonID[i] = row.id;
+        Parents[i] = {mother, father};
+        if (mother != -1)
+        {
+            if (Partner[mother] == -1)
+                Partner[mother] = father;
+            if (Partner[father] == -1)
+                Partner[father] = mother;
+        }
+        else
+            Headers.push_back(i);
+
+        if (partner != -1)
+        {
+            Partner[i] = partner;
+            if (Partner[partner] == -1)
+                Partner[partner] = i;
+        }
+    }
+    BuildMatings();
+
+    return true;
+}
+
+void PedigreeEngine::loadInteractive()
+{
+    cout << "Hello dear user!" << endl;
+    cout << "Please enter the number of people in your pedigree: ";
+    Source.release();
+    Rows.clear();
+    cin >> numOfPeople;
+    AllocatePedigree(numOfPeople);
+    PersonID.resize(numOfPeople); // No IDs: personID() numbers people from 1.
+    for (int i = 0; i < numOfPeople; i++)
+    {
+        bool gndr;
+        cout << "Enter the gender of person #" << i + 1 << ":" << endl;
+        cout << "1 if Female / 0 if Male -> ";
+        cin >> gndr;
+        gender.push_back(gndr);
+
+        pair<int, int> prnts;
+        cout << "Enter parents of #" << i + 1 << ":" << endl;
+        cout << "No parents? Just enter 0 as their parents." << endl;
+        cout << "#" << i + 1 << "'s mother -> ";
+        cin >> prnts.first;
+        cout << "#" << i + 1 << "'s father -> ";
+        cin >> prnts.second;
+        prnts.first--;
+        prnts.second--;
+        Parents.push_back(prnts);
+        if (prnts.first == -1)
+            Headers.push_back(i);
+
+        cout << "Enter the partner of #" << i + 1 << ":" << endl;
+        cout << "No partner? Enter 0." << endl;
+        cout << "-> ";
+        cin >> Partner[i];
+        Partner[i]--;
+
+        bool Affected;
+        cout << "Is #" << i + 1 << " affected? " << endl;
+        cout << "1 if yes / 0 if not -> ";
+        cin >> Affected;
+        AffectionFile.push_back(Affected);
+    }
+    BuildMatings();
+}
+
+bool PedigreeEngine::load(const string &path, const string &format, string &error)
+{
+    return ReadInput(path, Source, error) && LoadBuffer(format, error);
+}
+
+bool PedigreeEngine::loadText(string_view text, const string &format, string &error)
+{
+    Source.release();
+    Source.owned.assign(text.data(), text.size());
+    Source.data = Source.owned.data();
+    Source.size = Source.owned.size();
+    return LoadBuffer(format, error);
+}
+
+// The whole of Source is one pedigree, whatever family IDs it has.
+bool PedigreeEngine::LoadBuffer(const string &format, string &error)
+{
+    return ParseRows(Source.text(), format, Rows, Families, error) && IndexRows(Rows, Ids, error) &&
+           loadRows(Rows, 0, Rows.size(), Ids, error);
+}
+
+void PedigreeEngine::analyze()
+{
+    prepare();
+    propagate();
+    score();
+}
+
+void PedigreeEngine::prepare()
+{
+    PhaseTimer timer(Stats, PhasePrepare);
+    CountSibships();
+    if (!ScheduleLoaded)
+        BuildSchedule();
+}
+
+void PedigreeEngine::propagate()
+{
+    PhaseTimer timer(Stats, PhasePropagate);
+    bfs();
+}
+
+void PedigreeEngine::score()
+{
+    PhaseTimer timer(Stats, PhaseScore);
+    ScoreMatings();
+}
+
+void PedigreeEngine::reset()
+{
+    AllocatePedigree(0);
+    PruneModes = true;
+    Sibships.clear();
+    Matings.clear();
+    OffspringStart.clear();
+    Offspring.clear();
+    BirthMating.clear();
+    PersonMatingStart.clear();
+    PersonMatings.clear();
+    MatingOrder.clear();
+    GenerationStart.clear();
+    MatingFactor.clear();
+    Source.release();
+    Rows.clear();
+    for (int mode = 0; mode < 5; mode++)
+        Model_Prob[mode] = 0;
+}
+
+string PedigreeEngine::personID(int person) const
+{
+    return PersonID[person].size() ? string(PersonID[person]) : to_string(person + 1);
+}
+
+void PedigreeEngine::BuildSchedule()
+{
+    const vector<int> &start = PersonMatingStart, &matingsOf = PersonMatings;
+
+    // A mating is ready once both parents are resolved.
+    vector<char> &pending = Pending;
+    vector<int> &frontier = Scratch[0], &next = Scratch[1];
+    pending.assign(Matings.size(), 2);
+    frontier.assign(Headers.begin(), Headers.end());
+    MatingOrder.clear();
+    GenerationStart.clear();
+    MatingWave.assign(Matings.size(), -1);
+    Resolved.assign(numOfPeople, 0);
+    DirtyMarker.assign(Matings.size(), 0);
+    while (frontier.size())
+    {
+        GenerationStart.push_back(MatingOrder.size());
+        for (int person : frontier)
+        {
+            Resolved[person] = 1;
+            for (int k = start[person]; k < start[person + 1]; k++)
+                if (--pending[matingsOf[k]] == 0)
+                {
+                    MatingWave[matingsOf[k]] = GenerationStart.size() - 1;
+                    MatingOrder.push_back(matingsOf[k]);
+                }
+        }
+
+        next.clear();
+        for (int k = GenerationStart.back(); k < (int)MatingOrder.size(); k++)
+        {
+            int id = MatingOrder[k];
+            next.insert(next.end(), &Offspring[OffspringStart[id]], &Offspring[OffspringStart[id + 1]]);
+        }
+        frontier.swap(next);
+    }
+    GenerationStart.push_back(MatingOrder.size());
+}
+
+void PedigreeEngine::bfs()
+{
+    Live = 31;
+    for (ModePruning &pruned : Pruned)
+        pruned = ModePruning();
+    // With a cache, or while modes can be pruned, the matings are scored as
+    // their children are propagated.
+    if (Cache || PruneModes)
+        MatingFactor.assign(Matings.size(), array<double, 5>());
+    parallelFor(Headers.size(), 256, [this](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            PedStarters(Headers[i]);
+        if (Stats)
+            Stats->founders += end - begin;
+    });
+
+    array<double, 5> running = {};
+    if (PruneModes)
+        PruneModesAfter(-1, running);
+    for (int g = 0; g + 1 < (int)GenerationStart.size() && Live; g++)
+    {
+        const int *wave = &MatingOrder[GenerationStart[g]];
+        parallelFor(GenerationStart[g + 1] - GenerationStart[g], 64, [this, wave](int begin, int end) {
+            int children = 0;
+            for (int i = begin; i < end; i++)
+            {
+                children += PropagateChildren(wave[i]);
+                if (PruneModes && !Cache)
+                    ScoreMating(wave[i]);
+            }
+            if (Stats)
+                Stats->children += children;
+        });
+        if (PruneModes)
+            PruneModesAfter(g, running);
+    }
+}
+
+/*
+    Adds the factors of the founders (wave -1) or of a wave's matings to the
+    running log-likelihoods, in schedule order, and stops following the modes
+    that are out: those with a factor of 0, and those that fell more than
+    PruneBound behind the best mode still followed. Waves are scheduled the
+    same way whatever the thread count, so pruning is too.
+*/
+void PedigreeEngine::PruneModesAfter(int wave, array<double, 5> &running)
+{
+    int worstFounder[5] = {-1, -1, -1, -1, -1}, worstMating[5] = {-1, -1, -1, -1, -1};
+    array<double, 5> worst;
+    worst.fill(0);
+    auto add = [&](const array<double, 5> &factor, int founder, int mating) {
+        for (int mode = 0; mode < 5; mode++)
+        {
+            if (!(Live >> mode & 1))
+                continue;
+            if (factor[mode] == -INFINITY && Pruned[mode].reason == ModePruning::Live)
+                Pruned[mode] = {ModePruning::Impossible, wave, founder, mating, 0};
+            if (factor[mode] < worst[mode])
+            {
+                worst[mode] = factor[mode];
+                worstFounder[mode] = founder;
+                worstMating[mode] = mating;
+            }
+            running[mode] += factor[mode];
+        }
+    };
+    if (wave < 0)
+        for (int founder : Headers)
+            add(FounderFactor[founder], founder, -1);
+    else
+        for (int k = GenerationStart[wave]; k < GenerationStart[wave + 1]; k++)
+            add(MatingFactor[MatingOrder[k]], -1, MatingOrder[k]);
+
+    double best = -INFINITY;
+    for (int mode = 0; mode < 5; mode++)
+        if (Live >> mode & 1)
+            best = max(best, running[mode]);
+    for (int mode = 0; mode < 5; mode++)
+    {
+        if (!(Live >> mode & 1))
+            continue;
+        if (Pruned[mode].reason == ModePruning::Live && best - running[mode] > PruneBound)
+            Pruned[mode] = {ModePruning::Bound, wave, worstFounder[mode], worstMating[mode], best - running[mode]};
+        if (Pruned[mode].reason != ModePruning::Live)
+        {
+            Live &= ~(1 << mode);
+            if (Stats)
+                Stats->prunedModes++;
+        }
+    }
+}
+
+// Edits rescore single families, which needs every mode's genes: one full
+// pass without pruning, and none from then on.
+void PedigreeEngine::FollowEveryMode()
+{
+    PruneModes = false;
+    if (Live == 31)
+        return;
+    bfs();
+    ScoreMatings();
+}
+
+// Once every gene is known the matings are independent: score them all in one pass.
+void PedigreeEngine::ScoreMatings()
+{
+    if (!Cache && !PruneModes)
+    {
+        MatingFactor.assign(Matings.size(), array<double, 5>());
+        parallelFor(MatingOrder.size(), 64, [this](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                ScoreMating(MatingOrder[i]);
+        });
+    }
+
+    // Deterministic reduction, whatever the thread count.
+    for (int mode = 0; mode < 5; mode++)
+    {
+        FiniteSum[mode] = 0; // log(1)
+        ZeroCount[mode] = 0;
+    }
+    for (int founder : Headers)
+        AccumulateFactor(FounderFactor[founder], 1);
+    for (const array<double, 5> &factor : MatingFactor)
+        AccumulateFactor(factor, 1);
+    UpdateModelProb();
+    // Only part of a pruned mode's factors are in; it ranks as ruled out.
+    for (int mode = 0; mode < 5; mode++)
+        if (Pruned[mode].reason == ModePruning::Bound)
+            Model_Prob[mode] = -INFINITY;
+    if (Stats)
+    {
+        Stats->matings += MatingOrder.size();
+        for (int mode = 0; mode < 5; mode++)
+            Stats->zeroFactors += ZeroCount[mode];
+    }
+}
+
+void PedigreeEngine::AccumulateFactor(const array<double, 5> &factor, int sign)
+{
+    for (int mode = 0; mode < 5; mode++)
+    {
+        if (factor[mode] == -INFINITY)
+            ZeroCount[mode] += sign;
+        else
+            FiniteSum[mode] += sign * factor[mode];
+    }
+}
+
+void PedigreeEngine::UpdateModelProb()
+{
+    for (int mode = 0; mode < 5; mode++)
+        Model_Prob[mode] = ZeroCount[mode] ? -INFINITY : FiniteSum[mode];
+}
+
+void PedigreeEngine::parallelFor(int n, int grain, const function<void(int, int)> &body) const
+{
+    if (Pool)
+        Pool->parallelFor(n, grain, body);
+    else if (n > 0)
+        body(0, n);
+}
+
+// Ties keep the old order: by name, descending.
+void PedigreeEngine::rankModels()
+{
+    for (int i = 0; i < 5; i++)
+        mostLikableModel[i] = {Model_Prob[i], modeNames[i]};
+    sort(mostLikableModel, mostLikableModel + 5);
+    reverse(mostLikableModel, mostLikableModel + 5);
+    for (int i = 0; i < 5; i++)
+        modelRank[i] = find(modeNames, modeNames + 5, mostLikableModel[i].second) - modeNames;
+}
+
+// A mode no longer followed gets log(1), which leaves its running sum alone.
+void PedigreeEngine::ScoreMating(int id)
+{
+    Modes::forEach([this, id](auto mode) {
+        typedef decltype(mode) Mode;
+        MatingFactor[id][Mode::id] = Live >> Mode::id & 1 ? ScoreMode<Mode>(id) : 0;
+    });
+}
+
+// Returns how many children were propagated.
+int PedigreeEngine::PropagateChildren(int id)
+{
+    if (Cache)
+        PropagateCached(id);
+    else
+        for (int k = OffspringStart[id]; k < OffspringStart[id + 1]; k++)
+            ChildGenes(Offspring[k]);
+    return OffspringStart[id + 1] - OffspringStart[id];
+}
+
+/*
+    The children's genes and the mating's factors from the cache when a family
+    with the same parental genes and sibship has been seen; otherwise they are
+    computed and stored for the next one.
+*/
+void PedigreeEngine::PropagateCached(int id)
+{
+    FamilyKey key;
+    auto genes = [this](int person, double *out) {
+        for (int mode = 0; mode < 5; mode++)
+            out = Live >> mode & 1 ? copy_n(GeneProb(mode, person), modeStates[mode], out)
+                                   : fill_n(out, modeStates[mode], 0.0);
+    };
+    genes(Matings[id].mother, key.mother);
+    genes(Matings[id].father, key.father);
+    const Sibship &sibs = Sibships[id];
+    key.sibship[0] = sibs.affectedDaughters;
+    key.sibship[1] = sibs.unaffectedDaughters;
+    key.sibship[2] = sibs.affectedSons;
+    key.sibship[3] = sibs.unaffectedSons;
+    key.modes = Live;
+
+    FamilyResult result;
+    if (Cache->find(key, result))
+    {
+        for (int k = OffspringStart[id]; k < OffspringStart[id + 1]; k++)
+        {
+            const double *child = result.children[gender[Offspring[k]] * 2 + AffectionFile[Offspring[k]]];
+            for (int mode = 0; mode < 5; mode++)
+            {
+                if (Live >> mode & 1)
+                    copy_n(child, modeStates[mode], GeneProb(mode, Offspring[k]));
+                child += modeStates[mode];
+            }
+        }
+        MatingFactor[id] = result.factor;
+        return;
+    }
+
+    for (int k = OffspringStart[id]; k < OffspringStart[id + 1]; k++)
+    {
+        ChildGenes(Offspring[k]);
+        genes(Offspring[k], result.children[gender[Offspring[k]] * 2 + AffectionFile[Offspring[k]]]);
+    }
+    ScoreMating(id);
+    result.factor = MatingFactor[id];
+    Cache->insert(key, result);
+}
+
+/*
+    Incremental updates. Founder and mating factors are cached per item, so an edit
+    only redoes the genes below the edited person and the matings on the way,
+    in wave order, and patches the running sums.
+*/
+void PedigreeEngine::RecomputeGenes(int node)
+{
+    if (Parents[node].first == -1)
+    {
+        AccumulateFactor(FounderFactor[node], -1);
+        PedStarters(node);
+        AccumulateFactor(FounderFactor[node], 1);
+        if (Stats)
+            Stats->founders++;
+    }
+    else if (Resolved[node])
+        ChildGenes(node);
+}
+
+void PedigreeEngine::RescoreMating(int id)
+{
+    AccumulateFactor(MatingFactor[id], -1);
+    ScoreMating(id);
+    AccumulateFactor(MatingFactor[id], 1);
+    if (Stats)
+        Stats->matings++;
+}
+
+void PedigreeEngine::RescoreFrom(int person)
+{
+    // Every reached mating downstream of person.
+    vector<int> dirty, stack = {person};
+    while (stack.size())
+    {
+        int node = stack.back();
+        stack.pop_back();
+        for (int k = PersonMatingStart[node]; k < PersonMatingStart[node + 1]; k++)
+        {
+            int id = PersonMatings[k];
+            if (MatingWave[id] == -1 || DirtyMarker[id])
+                continue;
+            DirtyMarker[id] = 1;
+            dirty.push_back(id);
+            stack.insert(stack.end(), &Offspring[OffspringStart[id]], &Offspring[OffspringStart[id + 1]]);
+        }
+    }
+
+    // The family person was born into only sees its sibship change.
+    int id = BirthMating[person];
+    if (id != -1 && MatingWave[id] != -1 && !DirtyMarker[id])
+        RescoreMating(id);
+
+    RecomputeGenes(person);
+    sort(dirty.begin(), dirty.end(), [this](int a, int b) { return MatingWave[a] < MatingWave[b]; });
+    // Children are propagated directly, never through the cache: RescoreMating()
+    // has just scored the family, and an edited family is rarely seen again.
+    for (int id : dirty)
+    {
+        RescoreMating(id);
+        for (int k = OffspringStart[id]; k < OffspringStart[id + 1]; k++)
+            ChildGenes(Offspring[k]);
+        if (Stats)
+            Stats->children += OffspringStart[id + 1] - OffspringStart[id];
+        DirtyMarker[id] = 0;
+    }
+    UpdateModelProb();
+}
+
+void PedigreeEngine::SetAffection(int person, bool affected)
+{
+    if (AffectionFile[person] == affected)
+        return;
+    FollowEveryMode();
+
+    if (BirthMating[person] != -1)
+    {
+        Sibship &sibs = Sibships[BirthMating[person]];
+        int delta = affected ? 1 : -1;
+        if (gender[person])
+        {
+            sibs.affectedDaughters += delta;
+            sibs.unaffectedDaughters -= delta;
+        }
+        else
+        {
+            sibs.affectedSons += delta;
+            sibs.unaffectedSons -= delta;
+        }
+    }
+    AffectionFile[person] = affected;
+    RescoreFrom(person);
+}
+
+// Appends a person without children, e.g. a newborn, and scores it in.
+bool PedigreeEngine::AddPerson(string_view personID, bool female, int mother, int father, bool affected, string &error)
+{
+    if ((mother == -1) != (father == -1))
+    {
+        error = "a new person needs both parents or none";
+        return false;
+    }
+    if (mother != -1 && (!gender[mother] || gender[father]))
+    {
+        error = "the mother must be female and the father male";
+        return false;
+    }
+    FollowEveryMode();
+
+    int node = numOfPeople++;
+    ScheduleLoaded = false;
+    OwnedIDs.push_back(string(personID));
+    PersonID.push_back(OwnedIDs.back());
+    gender.push_back(female);
+    AffectionFile.push_back(affected);
+    Parents.push_back({mother, father});
+    Partner.push_back(-1);
+    BirthMating.push_back(-1);
+    FounderFactor.push_back(array<double, 5>());
+    for (int mode = 0; mode < 5; mode++)
+        Gene_Prob[mode].resize(Gene_Prob[mode].size() + modeStates[mode], 0);
+    PersonMatingStart.push_back(PersonMatingStart.back());
+    Resolved.push_back(0);
+
+    if (mother == -1)
+    {
+        Headers.push_back(node);
+        Resolved[node] = 1;
+        PedStarters(node);
+        AccumulateFactor(FounderFactor[node], 1);
+        UpdateModelProb();
+        return true;
+    }
+
+    // A new couple changes the mating table and the schedule: start over.
+    int id = FindMating(mother, father);
+    if (id == -1)
+    {
+        if (Partner[mother] == -1)
+            Partner[mother] = father;
+        if (Partner[father] == -1)
+            Partner[father] = mother;
+        BuildMatings();
+        CountSibships();
+        BuildSchedule();
+        bfs();
+        ScoreMatings();
+        return true;
+    }
+
+    BirthMating[node] = id;
+    Offspring.insert(Offspring.begin() + OffspringStart[id + 1], node);
+    for (int k = id + 1; k <= (int)Matings.size(); k++)
+        OffspringStart[k]++;
+    Sibship &sibs = Sibships[id];
+    if (female)
+        (affected ? sibs.affectedDaughters : sibs.unaffectedDaughters)++;
+    else
+        (affected ? sibs.affectedSons : sibs.unaffectedSons)++;
+
+    // Founders lose their "no children" factor with their first child.
+    for (int parent : {mother, father})
+        if (Parents[parent].first == -1 && ChildCount(parent) == 1)
+            RecomputeGenes(parent);
+
+    if (MatingWave[id] != -1)
+    {
+        Resolved[node] = 1;
+        RecomputeGenes(node);
+        RescoreMating(id);
+    }
+    UpdateModelProb();
+    return true;
+}
+
+void PedigreeEngine::PedStarters(int node)
+{
+    // Start from scratch, so an edited founder can be redone.
+    FounderFactor[node].fill(0);
+    for (int mode = 0; mode < 5; mode++)
+        fill_n(GeneProb(mode, node), modeStates[mode], 0.0);
+    Modes::forEach([this, node](auto mode) { FounderGenes<decltype(mode)>(node); });
+}
+
+/*
+    A founder's states are uniform a priori, weighed by how well they fit its
+    affection. Without children nothing else will ever look at those states, so
+    the chance of its affection is scored right here.
+*/
+template <class Mode>
+void PedigreeEngine::FounderGenes(int node)
+{
+    const SexTable &table = Mode::sex[gender[node]];
+    double *genes = GeneProb(Mode::id, node);
+    double total = 0;
+    for (int s = 0; s < table.states; s++)
+    {
+        genes[s] = AffectionFile[node] ? table.penetrance[s] : 1 - table.penetrance[s];
+        total += genes[s];
+    }
+    for (int s = 0; s < table.states; s++)
+        genes[s] = total > 0 ? genes[s] / total : 0;
+
+    if (!ChildCount(node))
+        FounderFactor[node][Mode::id] = log(total / table.states);
+}
+
+// A child's genes in every mode still followed, from its parents' genes and its own affection.
+void PedigreeEngine::ChildGenes(int node)
+{
+    bool affected = AffectionFile[node];
+    Modes::forEach([this, node, affected](auto mode) {
+        typedef decltype(mode) Mode;
+        if (!(Live >> Mode::id & 1))
+            return;
+        if (gender[node])
+            ChildGenes<Mode, 1>(node, affected);
+        else
+            ChildGenes<Mode, 0>(node, affected);
+    });
+}
+
+template <class Mode, int Sex>
+void PedigreeEngine::ChildGenes(int node, bool affected)
+{
+    constexpr const SexTable &child = Mode::sex[Sex];
+    double *genes = GeneProb(Mode::id, node);
+
+    // What each parent passes on: {D, R}. Zero table entries drop out at compile time.
+    double fromMom[2] = {0, 0}, fromDad[2] = {0, 0};
+    if constexpr (PassesAllele(child.fromMother, child.states))
+    {
+        const double *mom = GeneProb(Mode::id, Parents[node].first);
+        Unroll<2>([&](auto a) {
+            Unroll<Mode::sex[1].states>([&](auto s) {
+                if constexpr (Mode::sex[1].gamete[s][a] != 0)
+                    fromMom[a] += Mode::sex[1].gamete[s][a] * mom[s];
+            });
+        });
+    }
+    if constexpr (PassesAllele(child.fromFather, child.states))
+    {
+        const double *dad = GeneProb(Mode::id, Parents[node].second);
+        Unroll<2>([&](auto a) {
+            Unroll<Mode::sex[0].states>([&](auto s) {
+                if constexpr (Mode::sex[0].gamete[s][a] != 0)
+                    fromDad[a] += Mode::sex[0].gamete[s][a] * dad[s];
+            });
+        });
+    }
+
+    double others = 0;
+    Unroll<child.states>([&](auto s) {
+        constexpr int m = Mode::sex[Sex].fromMother[s], f = Mode::sex[Sex].fromFather[s];
+        if constexpr (s == Mode::sex[Sex].complement)
+            return;
+        else if constexpr (m != NoAllele && f != NoAllele)
+            genes[s] = fromMom[m] * fromDad[f];
+        else if constexpr (m != NoAllele)
+            genes[s] = fromMom[m];
+        else if constexpr (f != NoAllele)
+            genes[s] = fromDad[f];
+        else
+            genes[s] = 1;
+        others += genes[s];
+    });
+    if constexpr (child.complement != -1)
+        genes[child.complement] = 1 - others;
+
+    // Considering the facts...
+    Unroll<child.states>([&](auto s) {
+        genes[s] *= affected ? Mode::sex[Sex].penetrance[s] : 1 - Mode::sex[Sex].penetrance[s];
+    });
+}
+
+double LogProb(double p)
+{
+    // Rounding can leave "1 - (a + b)" a hair below zero.
+    return p > 0 ? log(p) : -INFINITY;
+}
+
+double LogSumExp(const double *x, int n)
+{
+    double top = -INFINITY;
+    for (int i = 0; i < n; i++)
+        top = max(top, x[i]);
+    if (top == -INFINITY)
+        return -INFINITY;
+
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += exp(x[i] - top);
+    return top + log(sum);
+}
+
+// log(AffProb^affected * (1 - AffProb)^unaffected), exact for AffProb of 0 and 1.
+double AffectionTerm(int affected, int unaffected, double AffProb)
+{
+    if (AffProb == 0)
+        return affected ? -INFINITY : 0;
+    if (AffProb == 1)
+        return unaffected ? -INFINITY : 0;
+    return affected * log(AffProb) + unaffected * log1p(-AffProb);
+}
+
+double PedigreeEngine::ChildrenAffectionProb(int id, double AffProb)
+{
+    const Sibship &sibs = Sibships[id];
+    return AffectionTerm(sibs.affectedDaughters + sibs.affectedSons,
+                         sibs.unaffectedDaughters + sibs.unaffectedSons, AffProb);
+}
+
+double PedigreeEngine::DaughtersAffectionProb(int id, double AffProb)
+{
+    const Sibship &sibs = Sibships[id];
+    return AffectionTerm(sibs.affectedDaughters, sibs.unaffectedDaughters, AffProb);
+}
+
+double PedigreeEngine::SonsAffectionProb(int id, double AffProb)
+{
+    const Sibship &sibs = Sibships[id];
+    return AffectionTerm(sibs.affectedSons, sibs.unaffectedSons, AffProb);
+}
+
+/*
+    A mating sums over every pair of parental states: the chance of the pair
+    times the chance of the sibship's affection given it. The chance a child is
+    affected for each pair is a compile-time table.
+*/
+template <class Mode>
+double PedigreeEngine::ScoreMode(int id)
+{
+    constexpr int motherStates = Mode::sex[1].states, fatherStates = Mode::sex[0].states;
+    const double *mom = GeneProb(Mode::id, Matings[id].mother);
+    const double *dad = GeneProb(Mode::id, Matings[id].father);
+    double logMom[motherStates], logDad[fatherStates];
+    Unroll<motherStates>([&](auto i) { logMom[i] = LogProb(mom[i]); });
+    Unroll<fatherStates>([&](auto j) { logDad[j] = LogProb(dad[j]); });
+
+    double Possibility[motherStates * fatherStates];
+    Unroll<motherStates>([&](auto i) {
+        Unroll<fatherStates>([&](auto j) {
+            constexpr double daughters = childAffection<Mode>.prob[1][i][j];
+            constexpr double sons = childAffection<Mode>.prob[0][i][j];
+            double &possibility = Possibility[i * fatherStates + j];
+            possibility = logMom[i] + logDad[j];
+            if constexpr (daughters == sons)
+                possibility += ChildrenAffectionProb(id, daughters);
+            else
+            {
+                possibility += DaughtersAffectionProb(id, daughters);
+                possibility += SonsAffectionProb(id, sons);
+            }
+        });
+    });
+
+    return LogSumExp(Possibility, motherStates * fatherStates);
+}
@@ -0,0 +1,467 @@
+/*
+    Pedigree Analysis - the analysis engine.
+    A PedigreeEngine owns all the state of one analysis, so a process can run
+    many of them, one after another or on several threads at once.
+*/
+
+#ifndef PEDIGREE_ENGINE_H
+#define PEDIGREE_ENGINE_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "PedigreeCache.h"
+#include "PedigreeModes.h"
+#include "PedigreeStats.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Input text: either an mmap'ed file or an owned copy (pipes, in-memory requests).
+struct InputBuffer
+{
+    const char *data = nullptr;
+    size_t size = 0;
+    void *mapping = nullptr; // Set when the input is mmap'ed.
+    string owned;            // Used when the input can't be mapped.
+
+    InputBuffer() = default;
+    InputBuffer(const InputBuffer &) = delete;
+    InputBuffer &operator=(const InputBuffer &) = delete;
+    ~InputBuffer() { release(); }
+    void release();
+    string_view text() const { return string_view(data, size); }
+};
+
+// One tokenized input line; the views point into an InputBuffer.
+struct InputRow
+{
+    int family;
+    int line;
+    string_view id, mother, father, partner;
+    bool female, affected;
+};
+
+struct PersonKey
+{
+    int family;
+    string_view id;
+    bool operator==(const PersonKey &other) const { return family == other.family && id == other.id; }
+};
+
+struct PersonKeyHash
+{
+    size_t operator()(const PersonKey &key) const
+    {
+        // FNV-1a, cheaper than std::hash for the short IDs we see.
+        uint64_t h = 1469598103934665603ULL ^ (uint64_t)key.family;
+        for (char c : key.id)
+            h = (h ^ (unsigned char)c) * 1099511628211ULL;
+        return h;
+    }
+};
+
+// Person IDs to row numbers, by open addressing in one flat table: indexing
+// makes no allocation per person, and the table is kept for the next input.
+class PersonIndex
+{
+public:
+    // Room for n people; forgets everyone.
+    void reserve(size_t n)
+    {
+        size_t size = 16;
+        while (size < 2 * n)
+            size *= 2;
+        slots.assign(size, Slot());
+        mask = size - 1;
+    }
+    // False if the key is already there. At most the reserved number of keys.
+    bool insert(const PersonKey &key, int row)
+    {
+        for (size_t i = Home(key);; i = (i + 1) & mask)
+        {
+            if (slots[i].row == -1)
+            {
+                slots[i] = {key, row};
+                return true;
+            }
+            if (slots[i].key == key)
+                return false;
+        }
+    }
+    // The row of key, or -1.
+    int find(const PersonKey &key) const
+    {
+        if (slots.empty())
+            return -1;
+        for (size_t i = Home(key);; i = (i + 1) & mask)
+            if (slots[i].row == -1 || slots[i].key == key)
+                return slots[i].row;
+    }
+
+private:
+    struct Slot
+    {
+        PersonKey key{};
+        int row = -1;
+    };
+    size_t Home(const PersonKey &key) const
+    {
+        uint64_t h = PersonKeyHash()(key);
+        return (h ^ h >> 32) & mask;
+    }
+    vector<Slot> slots;
+    size_t mask = 0;
+};
+
+bool ReadInput(const string &, InputBuffer &, string &);
+bool ParseRows(string_view, const string &, vector<InputRow> &, vector<string_view> &, string &);
+bool ParseTraits(string_view, const string &, int, int, const vector<InputRow> &, vector<string> &, vector<uint64_t> &,
+                 string &);
+bool IndexRows(const vector<InputRow> &, PersonIndex &, string &);
+
+// Sibship summary of each mating, so scoring never walks the children again.
+struct Sibship
+{
+    int affectedDaughters = 0, unaffectedDaughters = 0;
+    int affectedSons = 0, unaffectedSons = 0;
+};
+
+struct Mating
+{
+    int mother, father;
+};
+
+
+// Scorers return log-probabilities, so big pedigrees don't underflow.
+double LogProb(double);
+double LogSumExp(const double *, int);
+double AffectionTerm(int, int, double);
+
+enum ExportFormat { ExportDot, ExportJson };
+class GraphWriter;
+
+// Model parameters for sweep(): every combination of the three axes.
+struct SweepGrid
+{
+    vector<double> alleleFreq, penetrance, phenocopy; // An allele frequency of NaN: uniform founders.
+
+    size_t size() const { return alleleFreq.size() * penetrance.size() * phenocopy.size(); }
+    // Point k; the phenocopy rate varies fastest, the allele frequency slowest.
+    void point(size_t k, double &q, double &f, double &p) const
+    {
+        p = phenocopy[k % phenocopy.size()];
+        f = penetrance[k / phenocopy.size() % penetrance.size()];
+        q = alleleFreq[k / phenocopy.size() / penetrance.size()];
+    }
+};
+
+// One lane of a multi-lane traversal (PedigreeLanes.cpp): a model and the
+// affection it is scored on. The defaults are analyze()'s model.
+struct LanePoint
+{
+    double q = NAN, penetrance = 1, phenocopy = 0; // A q of NaN: uniform founders.
+    int trait = -1;                                // A column of loadTraits(); -1: the pedigree's affection.
+};
+struct LaneTables;
+
+// Settings for sample(): independent Gibbs chains per mode, each annealed
+// over the same ladder of rungs.
+struct McmcOptions
+{
+    int chains = 4;
+    int rungs = 32;
+    int burnIn = 20;  // Sweeps per rung before sampling...
+    int sweeps = 100; // ... and sweeps sampled per rung.
+    uint64_t seed = 1;
+};
+
+struct McmcReport
+{
+    double error[5] = {};         // Of the log-likelihood: the chains' spread and the ladder's discretisation.
+    double rHat[5] = {};          // Largest Gelman-Rubin R-hat over the rungs; 1 is converged.
+    long long sweeps = 0;         // Over every chain and mode.
+};
+struct McmcChain;
+
+// Where and why the forward pass stopped following a mode.
+struct ModePruning
+{
+    enum Reason { Live, Impossible, Bound } reason = Live;
+    int wave = -1;                 // The wave it happened in; -1 for the founders.
+    int founder = -1, mating = -1; // The first family that did it: a childless founder or a mating.
+    double behind = 0;             // Bound: how far the mode's running log-likelihood was behind the best.
+};
+
+// One connected family of analyzeComponents().
+struct ComponentResult
+{
+    int first = 0;  // Its lowest-numbered person.
+    int people = 0;
+    double logLikelihood[5] = {};
+};
+
+// Settings for significance(): replicates of each kind, and the seed of their generators.
+struct SignificanceOptions
+{
+    int replicates = 1000;
+    uint64_t seed = 1;
+};
+
+struct SignificanceReport
+{
+    // Share of permuted pedigrees (affection shuffled over the people) scoring
+    // at least the observed log-likelihood, per mode; 1 for an impossible mode.
+    double permutationP[5] = {};
+    // The observed best mode, which the bootstrap replicates are simulated
+    // under (-1 if no mode fits), and how often each mode ranks first on them.
+    int simulatedMode = -1;
+    double selected[5] = {};
+};
+
+// Per-person results of posteriors(), one column per value; row i is person i.
+struct PosteriorTable
+{
+    double logLikelihood[5]; // Exact, as peel() gives them.
+    double weight[5];        // P(mode | pedigree), every mode equally likely beforehand.
+    // P(state | pedigree, mode) by the mode's state index for the person's sex;
+    // NaN where the sex has no such state or the mode cannot explain the pedigree.
+    vector<double> state[5][3];
+    vector<double> carrier[5]; // P(carries the disease allele | pedigree, mode).
+    vector<double> carrierRisk; // carrier[] averaged over the modes by weight.
+};
+
+class PedigreeEngine
+{
+public:
+    // Loading. Each call replaces the previous pedigree.
+    bool load(const string &path, const string &format, string &error); // "-" reads stdin
+    bool loadText(string_view text, const string &format, string &error);
+    bool loadRows(const vector<InputRow> &rows, int begin, int end, const PersonIndex &ids, string &error);
+    void loadInteractive();
+    // Binary snapshot of the pedigree and its mating schedule (PedigreeSnapshot.cpp).
+    // A loaded snapshot stays mapped and skips parsing and the schedule build.
+    bool saveSnapshot(const string &path, string &error);
+    bool loadSnapshot(const string &path, string &error);
+    // After load() or loadText(): the affection column and the columns first ..
+    // first + count - 1 of the same text, each as a trait of its own (see
+    // ParseTraits(); first 0: none, or a CSV header's); trait 0 is the pedigree's affection.
+    bool loadTraits(const string &format, int first, int count, string &error);
+
+    // Analysis
+    void analyze(); // prepare(), propagate() and score(), in that order.
+    // analyze() one connected family at a time, each in an engine of its own
+    // on the pool (PedigreeComponents.cpp); the model log-likelihoods are the
+    // sums over the families. Leaves this engine's genes and schedule unset.
+    void analyzeComponents(vector<ComponentResult> &results);
+    void prepare();   // Sibship counts and the mating schedule.
+    void propagate(); // Gene probabilities, generation by generation.
+    void score();     // Mating factors and the model log-likelihoods.
+    // The exact likelihood of every mode by peeling (PedigreePeeling.cpp), in
+    // place of the forward pass's. Needs a pedigree without loops.
+    bool peel(string &error);
+    // With peel()'s pass back down from the roots: every person's posterior
+    // state probabilities and carrier risk, in O(n). Needs a pedigree without loops.
+    bool posteriors(PosteriorTable &table, string &error) const;
+    // Estimated likelihoods by Gibbs sampling (PedigreeMcmc.cpp), in place of
+    // the forward pass's; loops and consanguinity are fine. Chains run on the pool.
+    bool sample(const McmcOptions &options, McmcReport &report, string &error);
+    void rankModels();
+    // After analyze(): how far the forward pass's ranking stands out, from
+    // replicates re-scored on the same schedule (PedigreeSignificance.cpp).
+    void significance(const SignificanceOptions &options, SignificanceReport &report) const;
+    // Writes the pedigree graph; with shard, one file per connected family
+    // ("out.dot" becomes "out.1.dot", "out.2.dot", ...).
+    bool exportGraph(const string &path, ExportFormat format, bool shard, string &error) const;
+    // After prepare(): the log-likelihood of every mode at every grid point, in
+    // as few traversals as memoryBytes allows. Returns the number of traversals.
+    int sweep(const SweepGrid &grid, vector<array<double, 5>> &surface, size_t memoryBytes);
+    // After prepare() and loadTraits(): the log-likelihood of every mode for
+    // every trait (PedigreeTraits.cpp), each as analyze() would give it with
+    // that trait for the affection. Traits are lanes of one traversal, as many
+    // as memoryBytes allows. Returns the number of traversals.
+    int analyzeTraits(vector<array<double, 5>> &matrix, size_t memoryBytes);
+    // Forgets the pedigree but keeps every buffer for the next load.
+    void reset();
+
+    // Edits after analyze(), re-scored incrementally.
+    void SetAffection(int person, bool affected);
+    bool AddPerson(string_view personID, bool female, int mother, int father, bool affected, string &error);
+
+    void setThreadPool(ThreadPool *pool) { Pool = pool; }
+    void setStats(PedigreeStats *stats) { Stats = stats; } // Null (the default) turns instrumentation off.
+    // Null (the default) computes every family; the cache may be shared between engines.
+    void setCache(FamilyCache *cache) { Cache = cache; }
+    // The forward pass stops following a mode, wave by wave, once it has
+    // probability 0 or its running log-likelihood falls more than bound below
+    // the best mode's (INFINITY, the default: only at 0). A mode pruned by the
+    // bound is reported as -inf, like one with probability 0; pruning() says
+    // which was which. Edits follow every mode again.
+    void setPruneBound(double bound) { PruneBound = bound; }
+    const ModePruning &pruning(int mode) const { return Pruned[mode]; }
+    int matingMother(int id) const { return Matings[id].mother; }
+    int matingFather(int id) const { return Matings[id].father; }
+    int size() const { return numOfPeople; }
+    string personID(int person) const; // The input ID, or the 1-based number.
+    bool isFemale(int person) const { return gender[person]; }
+    bool isAffected(int person) const { return AffectionFile[person]; }
+    int traitCount() const { return TraitNames.size(); }
+    const string &traitName(int trait) const { return TraitNames[trait]; }
+    const double *logLikelihoods() const { return Model_Prob; }
+    // After rankModels(): modes and their log-likelihoods, best first.
+    int rankedMode(int i) const { return modelRank[i]; }
+    const pair<double, string> &rankedModel(int i) const { return mostLikableModel[i]; }
+
+private:
+    // People
+    int numOfPeople = 0;
+    vector<int> gender; // 1 if Female.
+    vector<bool> AffectionFile;
+    vector<string> TraitNames;  // loadTraits(): every trait column...
+    vector<uint64_t> TraitBits; // ... as TraitWords words of bits per person.
+    int TraitWords = 0;
+    vector<string_view> PersonID; // Original IDs from batch input.
+    InputBuffer Source;           // What PersonID points into, when the engine loaded it.
+    vector<InputRow> Rows;        // Parsing, kept between loads...
+    vector<string_view> Families;
+    PersonIndex Ids;
+    vector<int> Scratch[3];       // ... like the work lists of BuildMatings and BuildSchedule.
+    vector<char> Pending;
+
+    // Pedigree
+    vector<int> Partner; // First partner, as given or from the first child; -1 if none.
+    vector<pair<int, int>> Parents;
+
+    // Matings: every couple with a child, and every declared couple. A person can
+    // be in several, so half-sibs are kept apart.
+    vector<Mating> Matings;
+    vector<int> OffspringStart, Offspring;        // Children of mating k: Offspring[OffspringStart[k] .. OffspringStart[k + 1]).
+    vector<int> BirthMating;                      // The mating a person was born into, -1 for founders.
+    vector<int> PersonMatingStart, PersonMatings; // Matings of each person, flattened.
+    vector<Sibship> Sibships;                     // Per mating.
+
+    // bfs
+    /*
+        Matings are scheduled in generations: a mating belongs to the wave in which
+        its later parent was resolved, and its children are resolved in the next one.
+        Everything inside a wave is independent, so each wave runs in parallel.
+    */
+    vector<int> Headers; // Founders
+    vector<int> MatingOrder;     // Matings, wave by wave.
+    vector<int> GenerationStart; // Wave g is MatingOrder[GenerationStart[g] .. GenerationStart[g + 1]).
+    bool ScheduleLoaded = false; // Came with a snapshot: prepare() keeps it.
+    ThreadPool *Pool = nullptr;  // Null runs everything on the calling thread.
+    PedigreeStats *Stats = nullptr;
+    FamilyCache *Cache = nullptr;
+
+    // Pruning
+    unsigned char Live = 31; // Modes bfs still follows, bit per mode.
+    bool PruneModes = true;  // Off once edits need every mode's genes.
+    double PruneBound = INFINITY;
+    ModePruning Pruned[5];
+
+    // Incremental updates
+    vector<int> MatingWave;                       // -1 if the mating is never reached.
+    vector<char> Resolved;                        // Founders and children of reached matings.
+    vector<char> DirtyMarker;
+    double FiniteSum[5]; // Sum of the finite factors of each mode...
+    int ZeroCount[5];    // ... and how many factors are log(0).
+    deque<string> OwnedIDs; // IDs of people added after loading.
+
+    // Probability
+    vector<double> Gene_Prob[5];
+    double Model_Prob[5] = {}; // Log-likelihood of each mode.
+    // Per founder / per mating log factors, summed in a fixed order after bfs.
+    vector<array<double, 5>> FounderFactor;
+    vector<array<double, 5>> MatingFactor;
+    pair<double, string> mostLikableModel[5];
+    vector<double> LaneGenes[5]; // [person][state][lane], only while RunLanes() runs.
+    int LaneStride = 0;         // Lanes.
+    int modelRank[5] = {0, 1, 2, 3, 4};
+
+    double *GeneProb(int mode, int node)
+    {
+        return &Gene_Prob[mode][(size_t)node * modeStates[mode]];
+    }
+    double *LaneGene(int mode, int node)
+    {
+        return &LaneGenes[mode][(size_t)node * modeStates[mode] * LaneStride];
+    }
+
+    void AllocatePedigree(int);
+    int FindComponents(vector<int> &, vector<int> &) const;
+    void WriteDot(GraphWriter &, const int *, int) const;
+    void WriteJson(GraphWriter &, const int *, int) const;
+    bool LoadBuffer(const string &, string &);
+
+    void BuildMatings();
+    int FindMating(int, int) const;
+    int ChildCount(int) const;
+    void CountSibships();
+    void BuildSchedule();
+    void bfs();
+    void PruneModesAfter(int, array<double, 5> &);
+    void FollowEveryMode();
+    void ScoreMatings();
+    void parallelFor(int, int, const function<void(int, int)> &) const;
+    void ScoreMating(int);
+    int PropagateChildren(int);
+    void PropagateCached(int);
+
+    void AccumulateFactor(const array<double, 5> &, int);
+    void UpdateModelProb();
+    void RecomputeGenes(int);
+    void RescoreMating(int);
+    void RescoreFrom(int);
+
+    void PedStarters(int);
+    template <class Mode>
+    void FounderGenes(int);
+    void ChildGenes(int);
+    template <class Mode, int Sex>
+    void ChildGenes(int, bool);
+
+    double ChildrenAffectionProb(int, double);
+    double DaughtersAffectionProb(int, double);
+    double SonsAffectionProb(int, double);
+    template <class Mode>
+    double ScoreMode(int);
+
+    int PeelSchedule(vector<int> &, vector<int> &) const;
+    template <class Mode>
+    bool EliminateGenotypes(vector<unsigned char> &) const;
+    template <class Mode>
+    double PeelMode(const vector<int> &, const vector<int> &, const vector<unsigned char> &,
+                    vector<array<double, 3>> *upward = nullptr) const;
+    template <class Mode>
+    void PosteriorMode(const vector<int> &, const vector<int> &, PosteriorTable &) const;
+
+    bool BirthOrder(vector<int> &) const;
+    void CopyStructure(const PedigreeEngine &);
+    void LoadComponent(const PedigreeEngine &, const int *, int, const vector<int> &);
+    template <class Mode>
+    void SimulateAffection(const vector<int> &, uint64_t, vector<unsigned char> &, vector<bool> &) const;
+    template <class Mode>
+    void RunChain(const McmcOptions &, const vector<int> &, const vector<double> &, uint64_t, McmcChain &) const;
+
+    // Every point as a lane of the forward pass, at most widest lanes per
+    // traversal; matrix[k] is point k's log-likelihood per mode. Returns the
+    // number of traversals.
+    int RunLanes(const vector<LanePoint> &, int, size_t, vector<array<double, 5>> &);
+    template <class Mode, int Sex>
+    void LaneFounder(int, const LaneTables &, const double *, double *);
+    template <class Mode, int Sex>
+    void LaneChild(int, const LaneTables &, const double *);
+    template <class Mode>
+    void LaneScore(int, const LaneTables &, const double *, double *, double *);
+};
+
+#endif
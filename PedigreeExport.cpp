@@ -0,0 +1,350 @@
+/*
+    Pedigree Analysis - graph export (Graphviz DOT and JSON).
+    Everything is formatted straight into a fixed buffer that is flushed to the
+    file when full, so exporting never allocates per person or per couple.
+*/
+
+#include "PedigreeEngine.h"
+#include "PedigreeJson.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+class GraphWriter
+{
+public:
+    ~GraphWriter()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool open(const string &path, string &error)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            error = "cannot write " + path + ": " + strerror(errno);
+            return false;
+        }
+        name = &path;
+        return true;
+    }
+
+    bool close(string &error)
+    {
+        flush();
+        if (::close(fd) != 0)
+            failed = true;
+        fd = -1;
+        if (failed)
+            error = "cannot write " + *name + ": " + strerror(errno);
+        return !failed;
+    }
+
+    void put(string_view text)
+    {
+        if (used + text.size() > sizeof(buffer))
+        {
+            flush();
+            if (text.size() > sizeof(buffer))
+            {
+                writeAll(text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(buffer + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void put(char c)
+    {
+        if (used == sizeof(buffer))
+            flush();
+        buffer[used++] = c;
+    }
+
+    void number(long long value)
+    {
+        if (used + 24 > sizeof(buffer))
+            flush();
+        used = to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer;
+    }
+
+    // A JSON string, quotes included.
+    void quoted(string_view text)
+    {
+        put('"');
+        JsonEscape(text, [this](char c) { put(c); });
+        put('"');
+    }
+
+private:
+    void flush()
+    {
+        writeAll(buffer, used);
+        used = 0;
+    }
+
+    void writeAll(const char *data, size_t size)
+    {
+        while (size && !failed)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                failed = true;
+            else
+            {
+                data += n;
+                size -= n;
+            }
+        }
+    }
+
+    int fd = -1;
+    bool failed = false;
+    const string *name = nullptr;
+    size_t used = 0;
+    char buffer[1 << 16];
+};
+
+static int FindRoot(vector<int> &parent, int x)
+{
+    while (parent[x] != x)
+        x = parent[x] = parent[parent[x]];
+    return x;
+}
+
+// Groups people into connected families (through parents and partners), each
+// listed in increasing order; components are numbered by their first person.
+int PedigreeEngine::FindComponents(vector<int> &componentStart, vector<int> &members) const
+{
+    vector<int> parent(numOfPeople);
+    for (int i = 0; i < numOfPeople; i++)
+        parent[i] = i;
+    auto join = [&parent](int a, int b) {
+        if (b < 0)
+            return;
+        a = FindRoot(parent, a);
+        b = FindRoot(parent, b);
+        if (a != b)
+            parent[max(a, b)] = min(a, b);
+    };
+    for (int i = 0; i < numOfPeople; i++)
+    {
+        join(i, Parents[i].first);
+        join(i, Parents[i].second);
+        join(i, Partner[i]);
+    }
+
+    // The root is always the smallest member, so roots come in component order.
+    vector<int> component(numOfPeople);
+    int numOfComponents = 0;
+    for (int i = 0; i < numOfPeople; i++)
+        component[i] = FindRoot(parent, i) == i ? numOfComponents++ : component[FindRoot(parent, i)];
+    componentStart.assign(numOfComponents + 1, 0);
+    for (int i = 0; i < numOfPeople; i++)
+        componentStart[component[i] + 1]++;
+    for (int c = 0; c < numOfComponents; c++)
+        componentStart[c + 1] += componentStart[c];
+    members.resize(numOfPeople);
+    vector<int> next(componentStart.begin(), componentStart.end() - 1);
+    for (int i = 0; i < numOfPeople; i++)
+        members[next[component[i]]++] = i;
+    return numOfComponents;
+}
+
+void PedigreeEngine::WriteDot(GraphWriter &out, const int *people, int count) const
+{
+    out.put("digraph Pedigree {\n");
+    out.put("  rankdir=TB;\n"); // Tree layout: top to bottom
+    out.put("  node [fontname=\"Arial\", fontsize=12, style=filled, fillcolor=white];\n");
+    out.put("  edge [color=gray50];\n\n");
+
+    // Draw individuals
+    for (int k = 0; k < count; k++)
+    {
+        int i = people[k];
+        out.put("  Person_");
+        out.number(i + 1);
+        out.put(gender[i] ? " [label=\"♀ " : " [label=\"♂ ");
+        out.number(i + 1);
+        out.put(gender[i] ? "\", shape=circle" : "\", shape=box"); // Female: circle, Male: box
+        out.put(AffectionFile[i] ? ", color=red];\n" : ", color=black];\n");
+    }
+
+    out.put('\n');
+
+    // Draw couples and children
+    auto coupleNode = [&out](int a, int b) {
+        out.put("Couple_");
+        out.number(a + 1);
+        out.put('_');
+        out.number(b + 1);
+    };
+    for (int k = 0; k < count; k++)
+    {
+        int i = people[k];
+        for (int m = PersonMatingStart[i]; m < PersonMatingStart[i + 1]; m++)
+        {
+            int id = PersonMatings[m];
+            int partner = Matings[id].mother == i ? Matings[id].father : Matings[id].mother;
+            if (i > partner)
+                continue;
+
+            // Align couple horizontally
+            out.put("  { rank=same; Person_");
+            out.number(i + 1);
+            out.put("; Person_");
+            out.number(partner + 1);
+            out.put("; }\n");
+
+            // Invisible anchor node
+            out.put("  ");
+            coupleNode(i, partner);
+            out.put(" [shape=point, width=0, label=\"\"];\n");
+
+            // Horizontal line between partners
+            for (int person : {i, partner})
+            {
+                out.put("  Person_");
+                out.number(person + 1);
+                out.put(" -> ");
+                coupleNode(i, partner);
+                out.put(" [dir=none, constraint=false, color=gray70];\n");
+            }
+
+            // Children descend from couple node
+            for (int c = OffspringStart[id]; c < OffspringStart[id + 1]; c++)
+            {
+                out.put("  ");
+                coupleNode(i, partner);
+                out.put(" -> Person_");
+                out.number(Offspring[c] + 1);
+                out.put(" [color=gray30];\n");
+            }
+
+            out.put('\n');
+        }
+    }
+
+    out.put("}\n");
+}
+
+// {"people":[{"id","sex","affected","mother","father","partner"}...],"couples":[{"partners","children"}...]}
+// People are referred to by their input IDs, and a missing relative is null.
+void PedigreeEngine::WriteJson(GraphWriter &out, const int *people, int count) const
+{
+    auto id = [this, &out](int person) {
+        if (person < 0)
+            out.put("null");
+        else if (PersonID[person].size())
+            out.quoted(PersonID[person]);
+        else
+        {
+            out.put('"');
+            out.number(person + 1);
+            out.put('"');
+        }
+    };
+
+    out.put("{\"people\":[");
+    for (int k = 0; k < count; k++)
+    {
+        int i = people[k];
+        out.put(k ? ",\n{\"id\":" : "\n{\"id\":");
+        id(i);
+        out.put(gender[i] ? ",\"sex\":\"F\"" : ",\"sex\":\"M\"");
+        out.put(AffectionFile[i] ? ",\"affected\":true" : ",\"affected\":false");
+        out.put(",\"mother\":");
+        id(Parents[i].first);
+        out.put(",\"father\":");
+        id(Parents[i].second);
+        out.put(",\"partner\":");
+        id(Partner[i]);
+        out.put('}');
+    }
+    out.put("\n],\"couples\":[");
+    bool first = true;
+    for (int k = 0; k < count; k++)
+    {
+        int i = people[k];
+        for (int m = PersonMatingStart[i]; m < PersonMatingStart[i + 1]; m++)
+        {
+            int mating = PersonMatings[m];
+            int partner = Matings[mating].mother == i ? Matings[mating].father : Matings[mating].mother;
+            if (i > partner)
+                continue;
+            out.put(first ? "\n{\"partners\":[" : ",\n{\"partners\":[");
+            first = false;
+            id(i);
+            out.put(',');
+            id(partner);
+            out.put("],\"children\":[");
+            for (int c = OffspringStart[mating]; c < OffspringStart[mating + 1]; c++)
+            {
+                if (c > OffspringStart[mating])
+                    out.put(',');
+                id(Offspring[c]);
+            }
+            out.put("]}");
+        }
+    }
+    out.put("\n]}\n");
+}
+
+// "out/ped.dot", 3 -> "out/ped.3.dot"
+static string ShardPath(const string &path, int shard)
+{
+    size_t slash = path.find_last_of('/');
+    size_t dot = path.find_last_of('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash) || dot == slash + 1)
+        dot = path.size();
+    return path.substr(0, dot) + "." + to_string(shard) + path.substr(dot);
+}
+
+bool PedigreeEngine::exportGraph(const string &path, ExportFormat format, bool shard, string &error) const
+{
+    vector<int> componentStart, members;
+    int numOfShards = 1;
+    if (shard)
+        numOfShards = FindComponents(componentStart, members);
+    else
+    {
+        componentStart = {0, numOfPeople};
+        members.resize(numOfPeople);
+        for (int i = 0; i < numOfPeople; i++)
+            members[i] = i;
+    }
+
+    // Shards are independent files, so they are written in parallel.
+    vector<string> errors(numOfShards);
+    parallelFor(numOfShards, 16, [&](int begin, int end) {
+        for (int s = begin; s < end; s++)
+        {
+            GraphWriter out;
+            string file = shard ? ShardPath(path, s + 1) : path;
+            if (!out.open(file, errors[s]))
+                continue;
+            const int *people = members.data() + componentStart[s];
+            int count = componentStart[s + 1] - componentStart[s];
+            if (format == ExportJson)
+                WriteJson(out, people, count);
+            else
+                WriteDot(out, people, count);
+            out.close(errors[s]);
+        }
+    });
+    for (const string &e : errors)
+        if (e.size())
+        {
+            error = e;
+            return false;
+        }
+    return true;
+}
@@ -0,0 +1,44 @@
+/*
+    Pedigree Analysis - JSON string escaping.
+    Batch results, the graph export and the server all write person and family
+    IDs taken from the input into JSON strings; they escape them here, so a
+    quote, a backslash or a control character in an ID cannot break the output.
+*/
+
+#ifndef PEDIGREE_JSON_H
+#define PEDIGREE_JSON_H
+
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Hands text to put one character at a time, escaped for the inside of a JSON string.
+template <class Put>
+inline void JsonEscape(string_view text, Put put)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            put('\\');
+            put(c);
+        }
+        else if (c < 0x20)
+            for (char e : {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]})
+                put(e);
+        else
+            put(c);
+    }
+}
+
+// text as a JSON string, quotes included.
+inline string JsonString(string_view text)
+{
+    string out = "\"";
+    JsonEscape(text, [&out](char c) { out += c; });
+    return out + "\"";
+}
+
+#endif
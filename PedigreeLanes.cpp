@@ -0,0 +1,383 @@
+/*
+    Pedigree Analysis - many analyses in one traversal.
+    The parameter sweep and the trait matrix both run the forward pass many
+    times over one pedigree, with a different model or a different affection
+    each time. Each run is a lane: genes are stored [person][state][lane], so
+    one traversal of the pedigree runs every lane's founders, children and
+    matings with the same straight-line code per person, and the lane loops
+    vectorise. A lane has a founder prior, a penetrance and a phenocopy rate
+    (see PedigreeSweep.cpp) and an affection source: the pedigree's own
+    affection or a trait column (see PedigreeTraits.cpp).
+
+    Scoring works in linear space per mating: P(child affected) only takes a
+    few distinct values over all the modes' tables, so every power a sibship
+    needs is looked up in a per-lane table built once per traversal, and a
+    mating costs a handful of multiplications and one log per lane. Sibships
+    differ between traits, so a mating counts its children's affections per
+    lane as it propagates them instead of reading Sibships.
+*/
+
+#include "PedigreeEngine.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Lanes per traversal at most, whatever the caller asks for.
+const int maxLanes = 8;
+
+struct LaneTables
+{
+    int lanes;
+    // The pass's points, by field: q, penetrance, phenocopy and trait of each lane.
+    double q[maxLanes], penetrance[maxLanes], phenocopy[maxLanes];
+    int trait[maxLanes];
+    const vector<bool> *affection; // Lanes without a trait...
+    const uint64_t *bits;          // ... and the trait columns, words per person.
+    int words;
+    // childAffection<Mode>.prob[sex][i][j] is values[valueIndex[Mode::id][sex][i][j]].
+    vector<double> values;
+    int valueIndex[5][2][3][3];
+    // P(a child shows / does not show the trait)^n for every value and lane, n <= maxPower.
+    int maxPower;
+    vector<double> powers;
+
+    const double *power(int value, bool unaffected, int n) const
+    {
+        return &powers[(((size_t)value * 2 + unaffected) * (maxPower + 1) + n) * lanes];
+    }
+    // 1 where the person shows the lane's trait, 0 where not.
+    void affected(int person, double *shows) const
+    {
+        const uint64_t *row = bits + (size_t)person * words;
+        for (int l = 0; l < lanes; l++)
+        {
+            shows[l] = trait[l] < 0 ? (*affection)[person] : row[trait[l] / 64] >> trait[l] % 64 & 1;
+        }
+    }
+};
+
+template <class Mode, int Sex>
+void PedigreeEngine::LaneFounder(int node, const LaneTables &lanes, const double *affected, double *factor)
+{
+    constexpr const SexTable &table = Mode::sex[Sex];
+    constexpr int trait = TraitAllele<Mode>();
+    const int L = lanes.lanes;
+    double *genes = LaneGene(Mode::id, node);
+    bool childless = !ChildCount(node);
+
+    for (int l = 0; l < L; l++)
+    {
+        double q = lanes.q[l], f = lanes.penetrance[l], p = lanes.phenocopy[l];
+        // Hardy-Weinberg prior: a founder's "parents" pass on the allele that
+        // causes the trait (R under AR and XLR) with probability q. Without a
+        // q, the engine's uniform prior.
+        bool uniform = std::isnan(q);
+        double total = 0, others = 0;
+        Unroll<table.states>([&](auto s) {
+            constexpr int m = Mode::sex[Sex].fromMother[s], d = Mode::sex[Sex].fromFather[s];
+            if constexpr (s != Mode::sex[Sex].complement)
+            {
+                double prior = 1;
+                if (uniform)
+                    prior = 1.0 / table.states;
+                else
+                {
+                    if constexpr (m != NoAllele)
+                        prior *= m == trait ? q : 1 - q;
+                    if constexpr (d != NoAllele)
+                        prior *= d == trait ? q : 1 - q;
+                }
+                genes[s * L + l] = prior;
+                others += prior;
+            }
+        });
+        if constexpr (table.complement != -1)
+            genes[table.complement * L + l] = 1 - others;
+
+        Unroll<table.states>([&](auto s) {
+            double pen = p + (f - p) * Mode::sex[Sex].penetrance[s];
+            genes[s * L + l] *= affected[l] ? pen : 1 - pen;
+            total += genes[s * L + l];
+        });
+        Unroll<table.states>([&](auto s) { genes[s * L + l] = total > 0 ? genes[s * L + l] / total : 0; });
+        factor[l] = childless ? log(total) : 0;
+    }
+}
+
+template <class Mode, int Sex>
+void PedigreeEngine::LaneChild(int node, const LaneTables &lanes, const double *affected)
+{
+    constexpr const SexTable &child = Mode::sex[Sex];
+    const int L = lanes.lanes;
+    double *genes = LaneGene(Mode::id, node);
+    const double *mom = LaneGene(Mode::id, Parents[node].first);
+    const double *dad = LaneGene(Mode::id, Parents[node].second);
+
+    for (int l = 0; l < L; l++)
+    {
+        // What each parent passes on: {D, R}.
+        double fromMom[2] = {0, 0}, fromDad[2] = {0, 0};
+        Unroll<2>([&](auto a) {
+            if constexpr (PassesAllele(child.fromMother, child.states))
+                Unroll<Mode::sex[1].states>([&](auto s) {
+                    if constexpr (Mode::sex[1].gamete[s][a] != 0)
+                        fromMom[a] += Mode::sex[1].gamete[s][a] * mom[s * L + l];
+                });
+            if constexpr (PassesAllele(child.fromFather, child.states))
+                Unroll<Mode::sex[0].states>([&](auto s) {
+                    if constexpr (Mode::sex[0].gamete[s][a] != 0)
+                        fromDad[a] += Mode::sex[0].gamete[s][a] * dad[s * L + l];
+                });
+        });
+
+        double others = 0;
+        Unroll<child.states>([&](auto s) {
+            constexpr int m = Mode::sex[Sex].fromMother[s], f = Mode::sex[Sex].fromFather[s];
+            if constexpr (s == Mode::sex[Sex].complement)
+                return;
+            else
+            {
+                double p = 1;
+                if constexpr (m != NoAllele)
+                    p *= fromMom[m];
+                if constexpr (f != NoAllele)
+                    p *= fromDad[f];
+                genes[s * L + l] = p;
+                others += p;
+            }
+        });
+        if constexpr (child.complement != -1)
+            genes[child.complement * L + l] = 1 - others;
+
+        // Considering the facts...
+        double f = lanes.penetrance[l], p = lanes.phenocopy[l];
+        Unroll<child.states>([&](auto s) {
+            double pen = p + (f - p) * Mode::sex[Sex].penetrance[s];
+            genes[s * L + l] *= affected[l] ? pen : 1 - pen;
+        });
+    }
+}
+
+// sibship: P(the daughters' / sons' affections) for every value of P(child
+// affected) and lane, [value][sex][lane].
+template <class Mode>
+void PedigreeEngine::LaneScore(int id, const LaneTables &lanes, const double *sibship, double *factor, double *sum)
+{
+    constexpr int motherStates = Mode::sex[1].states, fatherStates = Mode::sex[0].states;
+    const int L = lanes.lanes;
+    const double *mom = LaneGene(Mode::id, Matings[id].mother);
+    const double *dad = LaneGene(Mode::id, Matings[id].father);
+
+    for (int l = 0; l < L; l++)
+        sum[l] = 0;
+    Unroll<motherStates>([&](auto i) {
+        Unroll<fatherStates>([&](auto j) {
+            // P(sibship's affection | parents in i, j).
+            const double *daughters = sibship + (lanes.valueIndex[Mode::id][1][i][j] * 2 + 1) * L;
+            const double *sons = sibship + lanes.valueIndex[Mode::id][0][i][j] * 2 * L;
+            const double *m = mom + i * L, *d = dad + j * L;
+            for (int l = 0; l < L; l++)
+                sum[l] += m[l] * d[l] * daughters[l] * sons[l];
+        });
+    });
+    for (int l = 0; l < L; l++)
+        factor[l] = LogProb(sum[l]);
+}
+
+int PedigreeEngine::RunLanes(const vector<LanePoint> &points, int widest, size_t memoryBytes,
+                             vector<array<double, 5>> &matrix)
+{
+    size_t count = points.size();
+    matrix.assign(count, array<double, 5>());
+    if (!count)
+        return 0;
+
+    LaneTables lanes;
+    lanes.affection = &AffectionFile;
+    lanes.bits = TraitBits.data();
+    lanes.words = TraitWords;
+    Modes::forEach([&lanes](auto mode) {
+        typedef decltype(mode) Mode;
+        for (int sex = 0; sex < 2; sex++)
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                {
+                    double value = childAffection<Mode>.prob[sex][i][j];
+                    int index = find(lanes.values.begin(), lanes.values.end(), value) - lanes.values.begin();
+                    if (index == (int)lanes.values.size())
+                        lanes.values.push_back(value);
+                    lanes.valueIndex[Mode::id][sex][i][j] = index;
+                }
+    });
+    // Whatever the affection, a sibship has no more daughters or sons than it has.
+    lanes.maxPower = 0;
+    for (const Sibship &sibs : Sibships)
+        lanes.maxPower = max({lanes.maxPower, sibs.affectedDaughters + sibs.unaffectedDaughters,
+                              sibs.affectedSons + sibs.unaffectedSons});
+    int values = lanes.values.size();
+
+    // As many lanes per pass as the memory budget allows, up to widest.
+    size_t perLane = (size_t)values * 2 * (lanes.maxPower + 1) * sizeof(double);
+    for (int mode = 0; mode < 5; mode++)
+        perLane += (size_t)numOfPeople * modeStates[mode] * sizeof(double);
+    size_t lanesPerPass =
+        max<size_t>(1, min({count, (size_t)min(widest, maxLanes), memoryBytes / max<size_t>(perLane, 1)}));
+    const int chunkSize = 256;
+
+    int passes = 0;
+    for (size_t first = 0; first < count; first += lanesPerPass, passes++)
+    {
+        int L = min(lanesPerPass, count - first);
+        lanes.lanes = LaneStride = L;
+        for (int l = 0; l < L; l++)
+        {
+            const LanePoint &point = points[first + l];
+            lanes.q[l] = point.q;
+            lanes.penetrance[l] = point.penetrance;
+            lanes.phenocopy[l] = point.phenocopy;
+            lanes.trait[l] = point.trait;
+        }
+        lanes.powers.resize((size_t)values * 2 * (lanes.maxPower + 1) * L);
+        for (int value = 0; value < values; value++)
+            for (int unaffected = 0; unaffected < 2; unaffected++)
+            {
+                double *row = (double *)lanes.power(value, unaffected, 0);
+                for (int l = 0; l < L; l++)
+                {
+                    double f = lanes.penetrance[l], p = lanes.phenocopy[l];
+                    double pen = p + (f - p) * lanes.values[value];
+                    double base = unaffected ? 1 - pen : pen;
+                    row[l] = 1;
+                    for (int n = 1; n <= lanes.maxPower; n++)
+                        row[n * L + l] = row[(n - 1) * L + l] * base;
+                }
+            }
+        for (int mode = 0; mode < 5; mode++)
+            LaneGenes[mode].resize((size_t)numOfPeople * modeStates[mode] * L);
+
+        // Log factors are summed per fixed-size chunk of the founders and of
+        // each wave, then the chunks in order, so the result doesn't depend on
+        // the thread count.
+        int waves = GenerationStart.size() - 1;
+        vector<int> chunkStart(waves + 2, 0); // Founders, then wave g's chunks from chunkStart[g + 1].
+        chunkStart[1] = (Headers.size() + chunkSize - 1) / chunkSize;
+        for (int g = 0; g < waves; g++)
+            chunkStart[g + 2] = chunkStart[g + 1] + (GenerationStart[g + 1] - GenerationStart[g] + chunkSize - 1) / chunkSize;
+        int chunks = chunkStart.back();
+        vector<double> finite((size_t)chunks * 5 * L, 0);
+        vector<int> zeros(finite.size(), 0);
+        auto accumulate = [&](int chunk, int mode, const double *factor) {
+            double *sum = &finite[((size_t)chunk * 5 + mode) * L];
+            int *zero = &zeros[((size_t)chunk * 5 + mode) * L];
+            for (int l = 0; l < L; l++)
+            {
+                if (factor[l] == -INFINITY)
+                    zero[l]++;
+                else
+                    sum[l] += factor[l];
+            }
+        };
+        // Like bfs(), a mode is dropped after the founders or a wave once it
+        // has probability 0: here, in every lane of the pass.
+        unsigned char live = 31;
+        vector<char> impossible(5 * L, 0);
+        auto dropModes = [&](int step) {
+            for (int chunk = chunkStart[step]; chunk < chunkStart[step + 1]; chunk++)
+                for (int k = 0; k < 5 * L; k++)
+                    impossible[k] |= zeros[(size_t)chunk * 5 * L + k] > 0;
+            for (int mode = 0; mode < 5; mode++)
+                if (all_of(&impossible[mode * L], &impossible[mode * L] + L, [](char zero) { return zero; }))
+                    live &= ~(1 << mode);
+        };
+
+        parallelFor(Headers.size(), chunkSize, [&](int begin, int end) {
+            double factor[maxLanes], affected[maxLanes];
+            for (int i = begin; i < end; i++)
+            {
+                int node = Headers[i];
+                lanes.affected(node, affected);
+                Modes::forEach([&](auto mode) {
+                    if (gender[node])
+                        LaneFounder<decltype(mode), 1>(node, lanes, affected, factor);
+                    else
+                        LaneFounder<decltype(mode), 0>(node, lanes, affected, factor);
+                    accumulate(i / chunkSize, decltype(mode)::id, factor);
+                });
+            }
+        });
+        dropModes(0);
+
+        // A mating's parents are done by its wave, so it is scored as its
+        // children are propagated, while their genes are still in cache.
+        for (int g = 0; g < waves && live; g++)
+        {
+            const int *wave = &MatingOrder[GenerationStart[g]];
+            parallelFor(GenerationStart[g + 1] - GenerationStart[g], chunkSize, [&](int begin, int end) {
+                double factor[maxLanes], sum[maxLanes], affected[maxLanes];
+                int counts[4 * maxLanes];
+                vector<double> sibship((size_t)values * 2 * L);
+                for (int i = begin; i < end; i++)
+                {
+                    int id = wave[i];
+                    fill_n(counts, 4 * L, 0);
+                    for (int k = OffspringStart[id]; k < OffspringStart[id + 1]; k++)
+                    {
+                        int child = Offspring[k];
+                        lanes.affected(child, affected);
+                        Modes::forEach([&](auto mode) {
+                            if (!(live >> decltype(mode)::id & 1))
+                                return;
+                            if (gender[child])
+                                LaneChild<decltype(mode), 1>(child, lanes, affected);
+                            else
+                                LaneChild<decltype(mode), 0>(child, lanes, affected);
+                        });
+                        int *shown = counts + (gender[child] ? 0 : 2 * L), *notShown = shown + L;
+                        for (int l = 0; l < L; l++)
+                        {
+                            shown[l] += affected[l];
+                            notShown[l] += 1 - affected[l];
+                        }
+                    }
+                    // Every mode's sibship terms come from the same few values.
+                    const int *daughters = counts, *sons = counts + 2 * L;
+                    for (int value = 0; value < values; value++)
+                    {
+                        double *row = &sibship[(size_t)value * 2 * L];
+                        for (int l = 0; l < L; l++)
+                        {
+                            row[l] = lanes.power(value, false, sons[l])[l] * lanes.power(value, true, sons[L + l])[l];
+                            row[L + l] = lanes.power(value, false, daughters[l])[l] *
+                                         lanes.power(value, true, daughters[L + l])[l];
+                        }
+                    }
+                    Modes::forEach([&](auto mode) {
+                        if (!(live >> decltype(mode)::id & 1))
+                            return;
+                        LaneScore<decltype(mode)>(id, lanes, sibship.data(), factor, sum);
+                        accumulate(chunkStart[g + 1] + i / chunkSize, decltype(mode)::id, factor);
+                    });
+                }
+            });
+            dropModes(g + 1);
+        }
+
+        for (int l = 0; l < L; l++)
+            for (int mode = 0; mode < 5; mode++)
+            {
+                double sum = 0;
+                int zero = 0;
+                for (int chunk = 0; chunk < chunks; chunk++)
+                {
+                    sum += finite[((size_t)chunk * 5 + mode) * L + l];
+                    zero += zeros[((size_t)chunk * 5 + mode) * L + l];
+                }
+                matrix[first + l][mode] = zero ? -INFINITY : sum;
+            }
+    }
+
+    // The lanes are only needed while running them.
+    for (int mode = 0; mode < 5; mode++)
+        vector<double>().swap(LaneGenes[mode]);
+    return passes;
+}
@@ -0,0 +1,348 @@
+/*
+    Pedigree Analysis - likelihoods by Gibbs sampling, for pedigrees with loops.
+    Cousin marriages and other loops defeat both the forward pass and peeling;
+    a Gibbs sampler only ever looks at one person and their relatives at a time,
+    so loops cost nothing.
+
+    With penetrance 0 or 1 every state assignment that fits the affections is
+    equally likely a posteriori, so posterior samples alone say nothing about
+    the likelihood. Instead the affections are softened: a person whose state
+    contradicts their affection costs a factor exp(-beta) instead of 0. With V
+    the number of such people,
+
+        Z(beta) = sum over assignments of P(states) exp(-beta V),
+        d log Z / d beta = -E_beta[V],   Z(0) = 1,
+
+    and Z(beta) tends to the likelihood as beta grows. Every chain climbs a
+    ladder of beta values, sampling E_beta[V] on each rung, and the integral
+    of E_beta[V] over the ladder (thermodynamic integration) plus the share of
+    samples with V = 0 on the top rung gives log L. The transmission and
+    penetrance come from the mode tables, the same ones the other engines use.
+*/
+
+#include "PedigreeEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// One chain of one mode: the mean and variance of V on each rung.
+struct McmcChain
+{
+    vector<double> mean, variance;
+    long long zeros = 0; // Samples with V = 0 on the top rung.
+};
+
+// Founders first, then every sibship once both its parents are in. False if
+// someone is their own ancestor.
+bool PedigreeEngine::BirthOrder(vector<int> &order) const
+{
+    order.clear();
+    order.reserve(numOfPeople);
+    for (int p = 0; p < numOfPeople; p++)
+        if (BirthMating[p] < 0)
+            order.push_back(p);
+    vector<unsigned char> parentsIn(Matings.size(), 0);
+    for (size_t head = 0; head < order.size(); head++)
+    {
+        int p = order[head];
+        for (int k = PersonMatingStart[p]; k < PersonMatingStart[p + 1]; k++)
+        {
+            int id = PersonMatings[k];
+            if (++parentsIn[id] == 2)
+                order.insert(order.end(), Offspring.begin() + OffspringStart[id], Offspring.begin() + OffspringStart[id + 1]);
+        }
+    }
+    return (int)order.size() == numOfPeople;
+}
+
+/*
+    Starts from a draw of the prior (uniform founders, Mendelian children), which
+    is exactly the chain's target on the bottom rung, and sweeps everyone in
+    turn. A person's state is drawn given their parents, their own affection and
+    every child they have with each partner.
+
+    Where the mode copies a parent's state to a child outright (the Y from
+    father to son), single-person updates could never change a whole lineage,
+    so such people form one block that is drawn together: all of them take the
+    same state, weighed by everything around the block.
+*/
+template <class Mode>
+void PedigreeEngine::RunChain(const McmcOptions &options, const vector<int> &order, const vector<double> &ladder,
+                              uint64_t seed, McmcChain &chain) const
+{
+    constexpr const ChildStateTable<Mode> &table = childStates<Mode>;
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> uniform(0, 1);
+    int n = numOfPeople;
+
+    // P(the person's affection | state); 0 marks a contradiction.
+    auto affection = [this](int p, int s) {
+        const SexTable &sex = Mode::sex[gender[p]];
+        return AffectionFile[p] ? sex.penetrance[s] : 1 - sex.penetrance[s];
+    };
+    auto draw = [&](const double *weights, int states, double total) {
+        double u = uniform(rng) * total;
+        int s = 0;
+        while (s < states - 1 && (u -= weights[s]) >= 0)
+            s++;
+        // Rounding can leave u past the last weight; never land on an impossible state.
+        while (weights[s] == 0)
+            s--;
+        return s;
+    };
+
+    vector<unsigned char> state(n);
+    long long violations = 0;
+    for (int p : order)
+    {
+        int sex = gender[p], states = Mode::sex[sex].states;
+        double weights[3];
+        double total = 0;
+        for (int s = 0; s < states; s++)
+        {
+            int id = BirthMating[p];
+            weights[s] = id < 0 ? 1 : table.prob[sex][s][state[Matings[id].mother]][state[Matings[id].father]];
+            total += weights[s];
+        }
+        state[p] = draw(weights, states, total);
+        violations += affection(p, state[p]) <= 0;
+    }
+
+    // copies[sex][0 / 1]: a child of this sex always has its mother's / father's state.
+    bool copies[2][2];
+    for (int sex = 0; sex < 2; sex++)
+        for (int side = 0; side < 2; side++)
+        {
+            const SexTable &parent = Mode::sex[side ? 0 : 1];
+            bool same = Mode::sex[sex].states == parent.states && parent.states > 1;
+            for (int s = 0; s < Mode::sex[sex].states && same; s++)
+                for (int i = 0; i < Mode::sex[1].states; i++)
+                    for (int j = 0; j < Mode::sex[0].states; j++)
+                        same = same && table.prob[sex][s][i][j] == (s == (side ? j : i));
+            copies[sex][side] = same;
+        }
+    vector<int> block(n);
+    for (int p = 0; p < n; p++)
+        block[p] = p;
+    auto root = [&block](int p) {
+        while (block[p] != p)
+            p = block[p] = block[block[p]];
+        return p;
+    };
+    for (int p = 0; p < n; p++)
+        if (BirthMating[p] >= 0)
+            for (int side = 0; side < 2; side++)
+                if (copies[gender[p]][side])
+                {
+                    const Mating &parents = Matings[BirthMating[p]];
+                    int a = root(p), b = root(side ? parents.father : parents.mother);
+                    block[max(a, b)] = min(a, b);
+                }
+    // Blocks as lists, in order of their first member.
+    vector<int> blockStart(n + 1, 0), members(n);
+    for (int p = 0; p < n; p++)
+        blockStart[root(p) + 1]++;
+    for (int p = 0; p < n; p++)
+        blockStart[p + 1] += blockStart[p];
+    {
+        vector<int> fill(blockStart.begin(), blockStart.end() - 1);
+        for (int p = 0; p < n; p++)
+            members[fill[root(p)]++] = p;
+    }
+
+    int rungs = ladder.size();
+    chain.mean.assign(rungs, 0);
+    chain.variance.assign(rungs, 0);
+    chain.zeros = 0;
+    for (int r = 0; r < rungs; r++)
+    {
+        double soft = exp(-ladder[r]);
+        double mean = 0, squares = 0; // Welford
+        for (int sweep = 0; sweep < options.burnIn + options.sweeps; sweep++)
+        {
+            for (int b = 0; b < n; b++)
+            {
+                if (blockStart[b] == blockStart[b + 1])
+                    continue;
+                const int *first = members.data() + blockStart[b], *last = members.data() + blockStart[b + 1];
+                int states = Mode::sex[gender[*first]].states, old = state[*first];
+                double weights[3];
+                double total = 0;
+                for (int s = 0; s < states; s++)
+                {
+                    double w = 1;
+                    for (const int *m = first; m < last; m++)
+                        state[*m] = s;
+                    for (const int *m = first; m < last && w > 0; m++)
+                    {
+                        int p = *m, id = BirthMating[p];
+                        if (id >= 0)
+                            w *= table.prob[gender[p]][s][state[Matings[id].mother]][state[Matings[id].father]];
+                        double term = affection(p, s);
+                        w *= term > 0 ? term : soft;
+                        for (int k = PersonMatingStart[p]; k < PersonMatingStart[p + 1] && w > 0; k++)
+                        {
+                            int mating = PersonMatings[k];
+                            int mother = state[Matings[mating].mother], father = state[Matings[mating].father];
+                            for (int c = OffspringStart[mating]; c < OffspringStart[mating + 1]; c++)
+                                w *= table.prob[gender[Offspring[c]]][state[Offspring[c]]][mother][father];
+                        }
+                    }
+                    weights[s] = w;
+                    total += w;
+                }
+                int s = draw(weights, states, total);
+                for (const int *m = first; m < last; m++)
+                {
+                    violations += (affection(*m, s) <= 0) - (affection(*m, old) <= 0);
+                    state[*m] = s;
+                }
+            }
+            int sample = sweep - options.burnIn;
+            if (sample < 0)
+                continue;
+            double delta = violations - mean;
+            mean += delta / (sample + 1);
+            squares += delta * (violations - mean);
+            if (r == rungs - 1 && !violations)
+                chain.zeros++;
+        }
+        chain.mean[r] = mean;
+        chain.variance[r] = options.sweeps > 1 ? squares / (options.sweeps - 1) : 0;
+    }
+}
+
+/*
+    Each mode runs options.chains chains, all on the pool at once; every chain
+    has its own generator seeded from options.seed and its index, so results do
+    not depend on the thread count. A mode genotype elimination rules out is
+    -inf without sampling; one it allows but no top-rung sample fits is an
+    error, not a mode the pedigree rules out.
+*/
+bool PedigreeEngine::sample(const McmcOptions &options, McmcReport &report, string &error)
+{
+    PhaseTimer timer(Stats, PhaseSample);
+    vector<int> order;
+    if (!BirthOrder(order))
+    {
+        error = "someone in the pedigree is their own ancestor";
+        return false;
+    }
+    if (options.sweeps < 1 || options.burnIn < 0)
+    {
+        error = "MCMC needs at least one sampled sweep per rung";
+        return false;
+    }
+
+    // Rung 0 samples the prior; the rest are spaced geometrically up to a beta
+    // where even one contradiction among everyone is unlikely.
+    int rungs = max(3, options.rungs);
+    double top = log(numOfPeople + 1.0) + 10;
+    vector<double> ladder(rungs, 0);
+    for (int r = 1; r < rungs; r++)
+        ladder[r] = top * pow(1e-3, double(rungs - 1 - r) / (rungs - 2));
+
+    int chains = max(1, options.chains);
+    bool possible[5];
+    Modes::forEach([&](auto mode) {
+        vector<unsigned char> mask;
+        possible[decltype(mode)::id] = EliminateGenotypes<decltype(mode)>(mask);
+    });
+    vector<McmcChain> runs(5 * chains);
+    parallelFor(5 * chains, 1, [&](int begin, int end) {
+        for (int task = begin; task < end; task++)
+            Modes::forEach([&](auto mode) {
+                typedef decltype(mode) Mode;
+                if (task / chains == Mode::id && possible[Mode::id])
+                    RunChain<Mode>(options, order, ladder, options.seed + 0x9e3779b97f4a7c15ull * (task + 1), runs[task]);
+            });
+    });
+
+    report.sweeps = 0;
+    for (int mode = 0; mode < 5; mode++)
+    {
+        report.error[mode] = 0;
+        report.rHat[mode] = 1;
+        if (!possible[mode])
+        {
+            Model_Prob[mode] = -INFINITY;
+            continue;
+        }
+        report.sweeps += (long long)chains * rungs * (options.burnIn + options.sweeps);
+        const McmcChain *run = &runs[mode * chains];
+
+        // Integral of E[V] over the ladder; E[V] decays roughly exponentially
+        // in beta, so each step is integrated as an exponential. With a stride
+        // of 2 it only takes every other rung (and the top one).
+        auto integrate = [&](const vector<double> &mean, int stride) {
+            double integral = 0;
+            for (int r = 0; r + 1 < rungs; r += stride)
+            {
+                int next = min(r + stride, rungs - 1);
+                double a = mean[r], b = mean[next], width = ladder[next] - ladder[r];
+                integral += a > 0 && b > 0 && a != b ? width * (a - b) / log(a / b) : width * (a + b) / 2;
+            }
+            return integral;
+        };
+        // Per chain: the integral and the share of top-rung samples with V = 0.
+        vector<double> logs(chains), fits(chains), pooled(rungs, 0);
+        long long zeros = 0;
+        for (int c = 0; c < chains; c++)
+        {
+            logs[c] = -integrate(run[c].mean, 1);
+            fits[c] = double(run[c].zeros) / options.sweeps;
+            zeros += run[c].zeros;
+            for (int r = 0; r < rungs; r++)
+                pooled[r] += run[c].mean[r] / chains;
+        }
+        if (!zeros)
+        {
+            error = string("no sample on the top rung fits the affections under ") + modeCodes[mode] +
+                    ", which genotype elimination allows; raise --mcmc-sweeps or --mcmc-rungs";
+            return false;
+        }
+        double mean = 0, fit = double(zeros) / ((long long)chains * options.sweeps);
+        for (double l : logs)
+            mean += l / chains;
+        Model_Prob[mode] = mean + log(fit);
+
+        // The error: the standard error from the spread between chains of both
+        // terms (the log of a chain's share taken to first order around the
+        // pooled one), and the ladder's discretisation error, taken as the
+        // change from dropping every other rung, which bounds the full ladder's
+        // own error generously.
+        double spread = 0;
+        for (int c = 0; c < chains; c++)
+        {
+            double deviation = logs[c] - mean + (fits[c] - fit) / fit;
+            spread += deviation * deviation;
+        }
+        double variance = chains > 1 ? spread / (chains - 1) / chains : 0;
+        double discretisation = integrate(pooled, 2) - integrate(pooled, 1);
+        report.error[mode] = sqrt(variance + discretisation * discretisation);
+
+        // Gelman-Rubin on V, rung by rung.
+        if (chains < 2 || options.sweeps < 2)
+        {
+            report.rHat[mode] = NAN;
+            continue;
+        }
+        double samples = options.sweeps;
+        for (int r = 0; r < rungs; r++)
+        {
+            double within = 0, grand = 0, between = 0;
+            for (int c = 0; c < chains; c++)
+            {
+                within += run[c].variance[r] / chains;
+                grand += run[c].mean[r] / chains;
+            }
+            for (int c = 0; c < chains; c++)
+                between += (run[c].mean[r] - grand) * (run[c].mean[r] - grand) * samples / (chains - 1);
+            double pooled = (samples - 1) / samples * within + between / samples;
+            double rHat = within > 0 ? sqrt(pooled / within) : between > 0 ? INFINITY : 1;
+            report.rHat[mode] = max(report.rHat[mode], rHat);
+        }
+    }
+    return true;
+}
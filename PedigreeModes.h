@@ -0,0 +1,222 @@
+/*
+    Pedigree Analysis - inheritance modes as compile-time tables.
+    A mode describes, for each sex, the genotype states, the alleles a parent in
+    each state passes on, how a child's state is made from its parents' alleles
+    and how likely each state is to show the trait. The propagation and scoring
+    kernels are templates over these traits, so every mode gets its own unrolled
+    code with no runtime dispatch; a new mode (mitochondrial, incomplete
+    penetrance, ...) only needs a new trait in the Modes list.
+*/
+
+#ifndef PEDIGREE_MODES_H
+#define PEDIGREE_MODES_H
+
+#include <string>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+/*
+    5 Modes, each with its own contiguous array holding only the genes it uses:
+    Mode 0, 1 (Autosome): {DD, DR, RR}
+    Mode 2, 3 (X_Linked): Female {XdXd, XdXr, XrXr} / Male {XdY, XrY}
+    Mode 4 (Y_Linked):    Male {XY*, XY} / Female {XX}
+*/
+enum AutosomeGene { DD, DR, RR };
+enum XFemaleGene { XdXd, XdXr, XrXr };
+enum XMaleGene { XdY, XrY };
+enum YMaleGene { XYd, XY }; // XYd is XY*
+enum YFemaleGene { XX };
+const int modeStates[5] = {3, 3, 3, 3, 2};
+const string modeNames[5] = {"Autosome Dominant Inheritance", "Autosome Recessive Inheritance",
+                             "X_Linked Dominant Inheritance", "X_Linked Recessive Inheritance",
+                             "Y_Linked Inheritance"};
+const char *const modeCodes[5] = {"AD", "AR", "XLD", "XLR", "YL"};
+
+// Alleles a parent passes on, named after the states above: D is the allele of
+// DD, XdY and XY*, R the allele of RR, XrY and XY. Neither is the disease
+// allele as such; which one causes the trait depends on the mode, see TraitAllele().
+enum Allele { D, R, NoAllele = -1 };
+
+struct SexTable
+{
+    int states;
+    double penetrance[3]; // P(affected | state)
+    double gamete[3][2];  // P(a parent in this state passes D / R)
+    // A child of this sex in state s got fromMother[s] and fromFather[s] (NoAllele:
+    // that parent passes nothing this mode tracks). The complement state, if any,
+    // takes whatever probability the others leave.
+    int fromMother[3], fromFather[3];
+    int complement;
+};
+
+// Tables are indexed by gender: [0] male, [1] female.
+struct AutosomalDominant
+{
+    static constexpr int id = 0;
+    static constexpr SexTable sex[2] = {
+        {3, {1, 1, 0}, {{1, 0}, {0.5, 0.5}, {0, 1}}, {D, NoAllele, R}, {D, NoAllele, R}, DR},
+        {3, {1, 1, 0}, {{1, 0}, {0.5, 0.5}, {0, 1}}, {D, NoAllele, R}, {D, NoAllele, R}, DR}};
+};
+
+struct AutosomalRecessive
+{
+    static constexpr int id = 1;
+    static constexpr SexTable sex[2] = {
+        {3, {0, 0, 1}, {{1, 0}, {0.5, 0.5}, {0, 1}}, {D, NoAllele, R}, {D, NoAllele, R}, DR},
+        {3, {0, 0, 1}, {{1, 0}, {0.5, 0.5}, {0, 1}}, {D, NoAllele, R}, {D, NoAllele, R}, DR}};
+};
+
+// Sons get their X from the mother only; daughters one X from each parent.
+struct XLinkedDominant
+{
+    static constexpr int id = 2;
+    static constexpr SexTable sex[2] = {
+        {2, {1, 0}, {{1, 0}, {0, 1}}, {D, R}, {NoAllele, NoAllele}, -1},
+        {3, {1, 1, 0}, {{1, 0}, {0.5, 0.5}, {0, 1}}, {D, NoAllele, R}, {D, NoAllele, R}, XdXr}};
+};
+
+struct XLinkedRecessive
+{
+    static constexpr int id = 3;
+    static constexpr SexTable sex[2] = {
+        {2, {0, 1}, {{1, 0}, {0, 1}}, {D, R}, {NoAllele, NoAllele}, -1},
+        {3, {0, 0, 1}, {{1, 0}, {0.5, 0.5}, {0, 1}}, {D, NoAllele, R}, {D, NoAllele, R}, XdXr}};
+};
+
+// Sons get the father's Y. Women have a single state (XX) that is never affected.
+struct YLinked
+{
+    static constexpr int id = 4;
+    static constexpr SexTable sex[2] = {
+        {2, {1, 0}, {{1, 0}, {0, 1}}, {NoAllele, NoAllele}, {D, R}, -1},
+        {1, {0}, {{0, 0}}, {NoAllele}, {NoAllele}, -1}};
+};
+
+// Calls body(integral_constant<int, I>()) for I = 0 .. N-1, fully unrolled; the
+// index can then be used in constant expressions (table lookups, if constexpr).
+template <class Body, int... I>
+inline void UnrollIndices(Body &&body, integer_sequence<int, I...>)
+{
+    (body(integral_constant<int, I>()), ...);
+}
+
+template <int N, class Body>
+inline void Unroll(Body &&body)
+{
+    UnrollIndices(body, make_integer_sequence<int, N>());
+}
+
+template <class... Mode>
+struct ModeList
+{
+    template <class Body>
+    static void forEach(Body &&body)
+    {
+        (body(Mode()), ...);
+    }
+};
+typedef ModeList<AutosomalDominant, AutosomalRecessive, XLinkedDominant, XLinkedRecessive, YLinked> Modes;
+
+// Whether a parent passes anything to a child with these states.
+constexpr bool PassesAllele(const int (&from)[3], int states)
+{
+    for (int s = 0; s < states; s++)
+        if (from[s] != NoAllele)
+            return true;
+    return false;
+}
+
+// P(a child of sex `sex` is in state `state`) when the parents are in states `mother` and `father`.
+template <class Mode>
+constexpr double ChildStateProb(int sex, int state, int mother, int father)
+{
+    const SexTable &child = Mode::sex[sex];
+    if (state == child.complement)
+    {
+        double rest = 1;
+        for (int s = 0; s < child.states; s++)
+            if (s != child.complement)
+                rest -= ChildStateProb<Mode>(sex, s, mother, father);
+        return rest;
+    }
+    double p = 1;
+    if (child.fromMother[state] != NoAllele)
+        p *= Mode::sex[1].gamete[mother][child.fromMother[state]];
+    if (child.fromFather[state] != NoAllele)
+        p *= Mode::sex[0].gamete[father][child.fromFather[state]];
+    return p;
+}
+
+// The allele that causes the trait: the one an affected person who passes a
+// single allele passes (DD under AD, RR under AR, XrY under XLR, ...). That is
+// D under AD, XLD and YL, and R under AR and XLR.
+template <class Mode>
+constexpr int TraitAllele()
+{
+    for (int sex = 0; sex < 2; sex++)
+        for (int s = 0; s < Mode::sex[sex].states; s++)
+            if (Mode::sex[sex].penetrance[s] > 0)
+                for (int allele = 0; allele < 2; allele++)
+                    if (Mode::sex[sex].gamete[s][allele] == 1)
+                        return allele;
+    return D;
+}
+static_assert(TraitAllele<AutosomalDominant>() == D && TraitAllele<AutosomalRecessive>() == R &&
+                  TraitAllele<XLinkedDominant>() == D && TraitAllele<XLinkedRecessive>() == R &&
+                  TraitAllele<YLinked>() == D,
+              "the trait allele of each mode, as documented above");
+
+// P(a child of sex `sex` is affected) for parents in states `mother` and `father`.
+template <class Mode>
+constexpr double ChildAffectedProb(int sex, int mother, int father)
+{
+    double p = 0;
+    for (int s = 0; s < Mode::sex[sex].states; s++)
+        p += ChildStateProb<Mode>(sex, s, mother, father) * Mode::sex[sex].penetrance[s];
+    return p;
+}
+
+// ChildAffectedProb for every pair of parental states, evaluated at compile time.
+template <class Mode>
+struct ChildAffectionTable
+{
+    double prob[2][3][3] = {}; // [child's sex][mother's state][father's state]
+
+    constexpr ChildAffectionTable()
+    {
+        for (int sex = 0; sex < 2; sex++)
+            for (int mother = 0; mother < Mode::sex[1].states; mother++)
+                for (int father = 0; father < Mode::sex[0].states; father++)
+                    prob[sex][mother][father] = ChildAffectedProb<Mode>(sex, mother, father);
+    }
+};
+template <class Mode>
+constexpr ChildAffectionTable<Mode> childAffection;
+
+// ChildStateProb for every child state and pair of parental states, and which
+// child states each pair can produce at all (a bitmask).
+template <class Mode>
+struct ChildStateTable
+{
+    double prob[2][3][3][3] = {}; // [child's sex][child's state][mother's state][father's state]
+    unsigned char possible[2][3][3] = {};
+
+    constexpr ChildStateTable()
+    {
+        for (int sex = 0; sex < 2; sex++)
+            for (int state = 0; state < Mode::sex[sex].states; state++)
+                for (int mother = 0; mother < Mode::sex[1].states; mother++)
+                    for (int father = 0; father < Mode::sex[0].states; father++)
+                    {
+                        prob[sex][state][mother][father] = ChildStateProb<Mode>(sex, state, mother, father);
+                        if (prob[sex][state][mother][father] > 0)
+                            possible[sex][mother][father] |= 1 << state;
+                    }
+    }
+};
+template <class Mode>
+constexpr ChildStateTable<Mode> childStates;
+
+#endif
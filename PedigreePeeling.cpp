@@ -0,0 +1,524 @@
+/*
+    Pedigree Analysis - exact likelihoods by peeling.
+    The forward pass (bfs / score) pushes affection-conditioned genes down the
+    pedigree and never lets descendants inform their ancestors. Here the model is
+    the same (uniform founder states, the mode's penetrance and transmission
+    tables) but the likelihood is the exact sum over every assignment of states,
+    computed Elston-Stewart style: people and matings form a tree when the
+    pedigree has no loops, and each node, leaves first, sums out its subtree
+    into a message for the node towards the root.
+
+    A Lange-Goradia genotype elimination runs first, so the sums only visit
+    states that some assignment consistent with the whole pedigree can use.
+*/
+
+#include "PedigreeEngine.h"
+
+#include <algorithm>
+#include <cmath>
+
+/*
+    People are nodes 0 .. numOfPeople-1, mating k is node numOfPeople + k.
+    order lists every node breadth first from the lowest person of its component,
+    up[] the node each one hands its message to (-1 for the roots). Returns the
+    number of loops: edges left over once the tree is spanned.
+*/
+int PedigreeEngine::PeelSchedule(vector<int> &order, vector<int> &up) const
+{
+    int n = numOfPeople;
+    vector<char> seen(n + Matings.size(), 0);
+    order.clear();
+    up.clear();
+    order.reserve(seen.size());
+    up.reserve(seen.size());
+
+    long long extraEdges = 0;
+    auto visit = [&](int node, int from) {
+        if (seen[node])
+            extraEdges++;
+        else
+        {
+            seen[node] = 1;
+            order.push_back(node);
+            up.push_back(from);
+        }
+    };
+    for (int root = 0; root < n; root++)
+    {
+        if (seen[root])
+            continue;
+        visit(root, -1);
+        for (size_t head = order.size() - 1; head < order.size(); head++)
+        {
+            int node = order[head], from = up[head];
+            if (node < n)
+            {
+                if (BirthMating[node] >= 0 && n + BirthMating[node] != from)
+                    visit(n + BirthMating[node], node);
+                for (int k = PersonMatingStart[node]; k < PersonMatingStart[node + 1]; k++)
+                    if (n + PersonMatings[k] != from)
+                        visit(n + PersonMatings[k], node);
+            }
+            else
+            {
+                int id = node - n;
+                if (Matings[id].mother != from)
+                    visit(Matings[id].mother, node);
+                if (Matings[id].father != from)
+                    visit(Matings[id].father, node);
+                for (int k = OffspringStart[id]; k < OffspringStart[id + 1]; k++)
+                    if (Offspring[k] != from)
+                        visit(Offspring[k], node);
+            }
+        }
+    }
+    // Every extra edge is met once from each end.
+    return extraEdges / 2;
+}
+
+/*
+    mask[p] holds the states person p may be in (bit s for state s). It starts
+    from the states that can show p's affection; then each mating keeps only
+    the parental pairs that can give every child a state still allowed, and
+    every member only the states such pairs use. A change reopens the matings
+    of whoever changed, until nothing moves. False if someone is left with no
+    state: the mode cannot explain the pedigree.
+*/
+template <class Mode>
+bool PedigreeEngine::EliminateGenotypes(vector<unsigned char> &mask) const
+{
+    constexpr const ChildStateTable<Mode> &table = childStates<Mode>;
+    int n = numOfPeople;
+    mask.resize(n);
+    for (int p = 0; p < n; p++)
+    {
+        const SexTable &sex = Mode::sex[gender[p]];
+        mask[p] = 0;
+        for (int s = 0; s < sex.states; s++)
+            if (AffectionFile[p] ? sex.penetrance[s] > 0 : sex.penetrance[s] < 1)
+                mask[p] |= 1 << s;
+        if (!mask[p])
+            return false;
+    }
+
+    vector<int> work(Matings.size());
+    vector<char> queued(Matings.size(), 1);
+    for (int id = 0; id < (int)Matings.size(); id++)
+        work[id] = Matings.size() - 1 - id;
+    vector<unsigned char> keep;
+    auto update = [&](int person, unsigned char states) {
+        if (states == mask[person])
+            return true;
+        mask[person] = states;
+        auto reopen = [&](int id) {
+            if (!queued[id])
+            {
+                queued[id] = 1;
+                work.push_back(id);
+            }
+        };
+        if (BirthMating[person] >= 0)
+            reopen(BirthMating[person]);
+        for (int k = PersonMatingStart[person]; k < PersonMatingStart[person + 1]; k++)
+            reopen(PersonMatings[k]);
+        return states != 0;
+    };
+
+    while (work.size())
+    {
+        int id = work.back();
+        work.pop_back();
+        queued[id] = 0;
+        int mother = Matings[id].mother, father = Matings[id].father;
+        const int *kids = Offspring.data() + OffspringStart[id];
+        int count = OffspringStart[id + 1] - OffspringStart[id];
+
+        unsigned char keepMother = 0, keepFather = 0;
+        keep.assign(count, 0);
+        for (int i = 0; i < Mode::sex[1].states; i++)
+        {
+            if (!(mask[mother] >> i & 1))
+                continue;
+            for (int j = 0; j < Mode::sex[0].states; j++)
+            {
+                if (!(mask[father] >> j & 1))
+                    continue;
+                bool fits = true;
+                for (int c = 0; c < count && fits; c++)
+                    fits = table.possible[gender[kids[c]]][i][j] & mask[kids[c]];
+                if (!fits)
+                    continue;
+                keepMother |= 1 << i;
+                keepFather |= 1 << j;
+                for (int c = 0; c < count; c++)
+                    keep[c] |= table.possible[gender[kids[c]]][i][j] & mask[kids[c]];
+            }
+        }
+        if (!update(mother, keepMother) || !update(father, keepFather))
+            return false;
+        for (int c = 0; c < count; c++)
+            if (!update(kids[c], keep[c]))
+                return false;
+    }
+    return true;
+}
+
+/*
+    One pass from the leaves to the roots. A person's vector starts as
+    P(its affection | state), times the uniform prior for founders, and gathers
+    the messages of the matings below it in the tree; a mating sums out every
+    member but the one above it. Messages are scaled to a maximum of 1 and the
+    scales summed in log space, so deep pedigrees and large sibships do not
+    underflow. With upward, every node's message to the node above it (a root
+    person's: its own vector) is kept for the pass back down.
+*/
+template <class Mode>
+double PedigreeEngine::PeelMode(const vector<int> &order, const vector<int> &up, const vector<unsigned char> &mask,
+                                vector<array<double, 3>> *upward) const
+{
+    constexpr const ChildStateTable<Mode> &table = childStates<Mode>;
+    constexpr int motherStates = Mode::sex[1].states, fatherStates = Mode::sex[0].states;
+    int n = numOfPeople;
+
+    vector<array<double, 3>> belief(n);
+    for (int p = 0; p < n; p++)
+    {
+        const SexTable &sex = Mode::sex[gender[p]];
+        double prior = BirthMating[p] < 0 ? 1.0 / sex.states : 1;
+        for (int s = 0; s < 3; s++)
+            belief[p][s] = mask[p] >> s & 1 ? prior * (AffectionFile[p] ? sex.penetrance[s] : 1 - sex.penetrance[s]) : 0;
+    }
+
+    double logScale = 0;
+    // Scales v to a maximum of 1; false if it is all zeros.
+    auto rescale = [&logScale](double *v, int size) {
+        double top = 0;
+        for (int s = 0; s < size; s++)
+            top = max(top, v[s]);
+        if (top <= 0)
+            return false;
+        for (int s = 0; s < size; s++)
+            v[s] /= top;
+        logScale += log(top);
+        return true;
+    };
+
+    double pairs[3][3];
+    for (int k = (int)order.size() - 1; k >= 0; k--)
+    {
+        int node = order[k], to = up[k];
+        if (node < n)
+        {
+            if (!rescale(belief[node].data(), 3))
+                return -INFINITY;
+            if (upward)
+                (*upward)[node] = belief[node];
+            if (to < 0)
+            {
+                double total = 0;
+                for (int s = 0; s < 3; s++)
+                    total += belief[node][s];
+                logScale += log(total);
+            }
+            continue;
+        }
+
+        int id = node - n;
+        int mother = Matings[id].mother, father = Matings[id].father;
+        const int *kids = Offspring.data() + OffspringStart[id];
+        int count = OffspringStart[id + 1] - OffspringStart[id];
+
+        // pairs[i][j]: the parents' own evidence times every child's but the target's.
+        fill(&pairs[0][0], &pairs[0][0] + 9, 0.0);
+        for (int i = 0; i < motherStates; i++)
+            for (int j = 0; j < fatherStates; j++)
+                pairs[i][j] = (mask[mother] >> i & 1) && (mask[father] >> j & 1)
+                                  ? (mother == to ? 1 : belief[mother][i]) * (father == to ? 1 : belief[father][j])
+                                  : 0;
+        for (int c = 0; c < count; c++)
+        {
+            int kid = kids[c];
+            if (kid == to)
+                continue;
+            int sex = gender[kid];
+            for (int i = 0; i < motherStates; i++)
+                for (int j = 0; j < fatherStates; j++)
+                {
+                    if (pairs[i][j] == 0)
+                        continue;
+                    double sum = 0;
+                    for (int s = 0; s < Mode::sex[sex].states; s++)
+                        if (mask[kid] >> s & 1)
+                            sum += table.prob[sex][s][i][j] * belief[kid][s];
+                    pairs[i][j] *= sum;
+                }
+            if (!rescale(&pairs[0][0], 9))
+                return -INFINITY;
+        }
+
+        double message[3] = {0, 0, 0};
+        if (to == mother)
+        {
+            for (int i = 0; i < motherStates; i++)
+                for (int j = 0; j < fatherStates; j++)
+                    message[i] += pairs[i][j];
+        }
+        else if (to == father)
+        {
+            for (int i = 0; i < motherStates; i++)
+                for (int j = 0; j < fatherStates; j++)
+                    message[j] += pairs[i][j];
+        }
+        else
+        {
+            int sex = gender[to];
+            for (int s = 0; s < Mode::sex[sex].states; s++)
+                if (mask[to] >> s & 1)
+                    for (int i = 0; i < motherStates; i++)
+                        for (int j = 0; j < fatherStates; j++)
+                            message[s] += pairs[i][j] * table.prob[sex][s][i][j];
+        }
+        for (int s = 0; s < 3; s++)
+            belief[to][s] *= message[s];
+        if (upward)
+            (*upward)[node] = {message[0], message[1], message[2]};
+    }
+    return logScale;
+}
+
+/*
+    Replaces the model log-likelihoods with the exact ones; the modes run in
+    parallel on the pool. A pedigree with loops (cousin marriages, two
+    brothers marrying two sisters, ...) is refused: its people and matings do
+    not form a tree.
+*/
+bool PedigreeEngine::peel(string &error)
+{
+    PhaseTimer timer(Stats, PhasePeel);
+    vector<int> order, up;
+    int loops = PeelSchedule(order, up);
+    if (loops)
+    {
+        error = "the pedigree has " + to_string(loops) + (loops == 1 ? " loop" : " loops") +
+                "; peeling needs a pedigree without loops";
+        return false;
+    }
+
+    double exact[5];
+    parallelFor(5, 1, [&](int begin, int end) {
+        Modes::forEach([&](auto mode) {
+            typedef decltype(mode) Mode;
+            if (Mode::id < begin || Mode::id >= end)
+                return;
+            vector<unsigned char> mask;
+            exact[Mode::id] = EliminateGenotypes<Mode>(mask) ? PeelMode<Mode>(order, up, mask) : -INFINITY;
+        });
+    });
+    for (int i = 0; i < 5; i++)
+        Model_Prob[i] = exact[i];
+    return true;
+}
+
+/*
+    The pass back down, roots first. Every node receives the message of the node
+    above it, which sums up the whole pedigree on that side; with the messages
+    kept on the way up, each person then has the evidence of everyone. A person
+    hands each mating below it its own evidence, the message from above and the
+    messages of its other matings; a mating hands each member below it what the
+    other members say. Products over a person's matings and over a sibship
+    leave one factor out by prefix and suffix products, so the pass stays
+    linear. Messages are scaled to a maximum of 1 as they go: only the
+    normalised posteriors are kept, so the scales never matter.
+*/
+template <class Mode>
+void PedigreeEngine::PosteriorMode(const vector<int> &order, const vector<int> &up, PosteriorTable &table) const
+{
+    constexpr const ChildStateTable<Mode> &states = childStates<Mode>;
+    constexpr int motherStates = Mode::sex[1].states, fatherStates = Mode::sex[0].states;
+    constexpr int mode = Mode::id, trait = TraitAllele<Mode>();
+    int n = numOfPeople, nodes = order.size();
+    for (int s = 0; s < 3; s++)
+        table.state[mode][s].assign(n, NAN);
+    table.carrier[mode].assign(n, NAN);
+
+    vector<unsigned char> mask;
+    vector<array<double, 3>> upward(nodes), down(nodes);
+    table.logLikelihood[mode] = EliminateGenotypes<Mode>(mask) ? PeelMode<Mode>(order, up, mask, &upward) : -INFINITY;
+    if (table.logLikelihood[mode] == -INFINITY)
+        return;
+
+    // Each node's children in the tree, in visiting order.
+    vector<int> childStart(nodes + 1, 0), children(nodes);
+    for (int k = 0; k < nodes; k++)
+        if (up[k] >= 0)
+            childStart[up[k] + 1]++;
+    for (int node = 0; node < nodes; node++)
+        childStart[node + 1] += childStart[node];
+    {
+        vector<int> fill(childStart.begin(), childStart.end() - 1);
+        for (int k = 0; k < nodes; k++)
+            if (up[k] >= 0)
+                children[fill[up[k]]++] = order[k];
+    }
+
+    auto rescale = [](double *v, int size) {
+        double top = *max_element(v, v + size);
+        if (top > 0)
+            for (int s = 0; s < size; s++)
+                v[s] /= top;
+    };
+    vector<array<double, 3>> after3;
+    vector<array<double, 9>> sums, after9;
+    for (int k = 0; k < nodes; k++)
+    {
+        int node = order[k], from = up[k];
+        if (node < n)
+        {
+            const SexTable &sex = Mode::sex[gender[node]];
+            double prior = BirthMating[node] < 0 ? 1.0 / sex.states : 1;
+            array<double, 3> above = from >= 0 ? down[node] : array<double, 3>{1, 1, 1};
+
+            double post[3], total = 0;
+            for (int s = 0; s < 3; s++)
+                total += post[s] = upward[node][s] * above[s];
+            double carrier = 0;
+            for (int s = 0; s < sex.states; s++)
+            {
+                table.state[mode][s][node] = post[s] / total;
+                if (sex.gamete[s][trait] > 0)
+                    carrier += post[s] / total;
+            }
+            table.carrier[mode][node] = carrier;
+
+            // Own evidence and the message from above, then every mating below but one.
+            double before[3];
+            for (int s = 0; s < 3; s++)
+                before[s] = mask[node] >> s & 1
+                                ? above[s] * prior * (AffectionFile[node] ? sex.penetrance[s] : 1 - sex.penetrance[s])
+                                : 0;
+            int first = childStart[node], count = childStart[node + 1] - first;
+            after3.assign(count + 1, {1, 1, 1});
+            for (int c = count - 1; c >= 0; c--)
+            {
+                for (int s = 0; s < 3; s++)
+                    after3[c][s] = after3[c + 1][s] * upward[children[first + c]][s];
+                rescale(after3[c].data(), 3);
+            }
+            for (int c = 0; c < count; c++)
+            {
+                int mating = children[first + c];
+                for (int s = 0; s < 3; s++)
+                    down[mating][s] = before[s] * after3[c + 1][s];
+                rescale(down[mating].data(), 3);
+                for (int s = 0; s < 3; s++)
+                    before[s] *= upward[mating][s];
+                rescale(before, 3);
+            }
+            continue;
+        }
+
+        int id = node - n;
+        int mother = Matings[id].mother, father = Matings[id].father;
+        const int *kids = Offspring.data() + OffspringStart[id];
+        int count = OffspringStart[id + 1] - OffspringStart[id];
+        // What each member says about itself: the message from above for the
+        // member above, the kept upward message for the others.
+        auto said = [&](int person) -> const array<double, 3> & { return person == from ? down[node] : upward[person]; };
+
+        // sums[c][i][j]: P(child c's evidence | parents in i, j); after9[c]: the product from c on.
+        sums.resize(count);
+        after9.assign(count + 1, {});
+        fill(after9[count].begin(), after9[count].end(), 1.0);
+        for (int c = count - 1; c >= 0; c--)
+        {
+            int sex = gender[kids[c]];
+            const array<double, 3> &child = said(kids[c]);
+            for (int i = 0; i < motherStates; i++)
+                for (int j = 0; j < fatherStates; j++)
+                {
+                    double sum = 0;
+                    for (int s = 0; s < Mode::sex[sex].states; s++)
+                        sum += states.prob[sex][s][i][j] * child[s];
+                    sums[c][i * 3 + j] = sum;
+                    after9[c][i * 3 + j] = after9[c + 1][i * 3 + j] * sum;
+                }
+            rescale(after9[c].data(), 9);
+        }
+
+        const array<double, 3> &motherSaid = said(mother), &fatherSaid = said(father);
+        if (mother != from)
+        {
+            array<double, 3> &message = down[mother];
+            message = {0, 0, 0};
+            for (int i = 0; i < motherStates; i++)
+                for (int j = 0; j < fatherStates; j++)
+                    message[i] += after9[0][i * 3 + j] * fatherSaid[j];
+            rescale(message.data(), 3);
+        }
+        if (father != from)
+        {
+            array<double, 3> &message = down[father];
+            message = {0, 0, 0};
+            for (int i = 0; i < motherStates; i++)
+                for (int j = 0; j < fatherStates; j++)
+                    message[j] += after9[0][i * 3 + j] * motherSaid[i];
+            rescale(message.data(), 3);
+        }
+        double before[9] = {};
+        for (int i = 0; i < motherStates; i++)
+            for (int j = 0; j < fatherStates; j++)
+                before[i * 3 + j] = motherSaid[i] * fatherSaid[j];
+        for (int c = 0; c < count; c++)
+        {
+            int kid = kids[c], sex = gender[kid];
+            if (kid != from)
+            {
+                array<double, 3> &message = down[kid];
+                message = {0, 0, 0};
+                for (int s = 0; s < Mode::sex[sex].states; s++)
+                    for (int i = 0; i < motherStates; i++)
+                        for (int j = 0; j < fatherStates; j++)
+                            message[s] += before[i * 3 + j] * after9[c + 1][i * 3 + j] * states.prob[sex][s][i][j];
+                rescale(message.data(), 3);
+            }
+            for (int pair = 0; pair < 9; pair++)
+                before[pair] *= sums[c][pair];
+            rescale(before, 9);
+        }
+    }
+}
+
+/*
+    Every mode's posteriors on the pool, then the modes weighed by their exact
+    likelihoods into one carrier risk per person. Model_Prob is left alone.
+*/
+bool PedigreeEngine::posteriors(PosteriorTable &table, string &error) const
+{
+    PhaseTimer timer(Stats, PhasePosteriors);
+    vector<int> order, up;
+    int loops = PeelSchedule(order, up);
+    if (loops)
+    {
+        error = "the pedigree has " + to_string(loops) + (loops == 1 ? " loop" : " loops") +
+                "; posteriors need a pedigree without loops";
+        return false;
+    }
+
+    parallelFor(5, 1, [&](int begin, int end) {
+        Modes::forEach([&](auto mode) {
+            typedef decltype(mode) Mode;
+            if (Mode::id >= begin && Mode::id < end)
+                PosteriorMode<Mode>(order, up, table);
+        });
+    });
+
+    double total = LogSumExp(table.logLikelihood, 5);
+    for (int mode = 0; mode < 5; mode++)
+        table.weight[mode] = total == -INFINITY ? NAN : exp(table.logLikelihood[mode] - total);
+    table.carrierRisk.assign(numOfPeople, total == -INFINITY ? NAN : 0);
+    for (int mode = 0; mode < 5; mode++)
+        if (table.weight[mode] > 0)
+            for (int p = 0; p < numOfPeople; p++)
+                table.carrierRisk[p] += table.weight[mode] * table.carrier[mode][p];
+    return true;
+}
@@ -0,0 +1,630 @@
+/*
+    Pedigree Analysis - resident server (--serve).
+    A pipeline that would start the analyser once per pedigree keeps one process
+    instead. Requests come in on stdin or on a Unix domain socket (one stream per
+    connection). Each is analysed by one of a fixed set of workers whose engine
+    keeps its buffers from request to request, and the answer goes back on the
+    same stream as soon as it is ready: answers can overtake each other, and the
+    id ties them to their request.
+
+    A request is either one JSON object on a line (only "pedigree" is required)
+
+        {"id": "r1", "format": "ped", "engine": "forward", "pedigree": "F1 1 0 0 1 2\n..."}
+
+    or a line with a byte count and an optional id, then that many bytes of
+    pedigree text:
+
+        2048 r1
+
+    Every request gets one JSON line back,
+
+        {"id":"r1","people":12,"best":"AD","ranking":[...],"logLikelihood":{...},"ms":0.21}
+
+    or {"id":"r1","error":"..."}; "ms" is the time spent on the request itself.
+
+    Requests wait in a bounded queue. When it is full the readers stop reading,
+    so a client sending faster than the workers can answer is held back by its
+    own stream instead of growing the server. The same bound caps the
+    connections read at once, and a request line, like a byte count, may not
+    exceed 16 MiB, so the requests held are at most twice the bound times that.
+    When the server stops, it ends every read still going and waits for the
+    readers before it returns.
+*/
+
+#include "PedigreeServer.h"
+#include "PedigreeJson.h"
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+
+const size_t maxRequestBytes = 16 << 20;
+
+// One client stream: requests are read from in, answers written to out.
+struct Connection
+{
+    int in, out;
+    mutex lock; // Workers answer concurrently; one line at a time.
+
+    Connection(int in, int out) : in(in), out(out) {}
+    ~Connection()
+    {
+        if (in > 2)
+            close(in);
+        if (out > 2 && out != in)
+            close(out);
+    }
+
+    void send(const string &line)
+    {
+        lock_guard<mutex> guard(lock);
+        for (size_t done = 0; done < line.size();)
+        {
+            ssize_t n = out > 2 ? ::send(out, line.data() + done, line.size() - done, MSG_NOSIGNAL)
+                                : write(out, line.data() + done, line.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return; // The client is gone; its answers go nowhere.
+            done += n;
+        }
+    }
+};
+
+struct Request
+{
+    shared_ptr<Connection> connection;
+    string id = "null"; // As it goes back: a JSON string, number or literal.
+    string format, engine, text;
+    string error; // Set when the request itself is malformed: answered without an analysis.
+};
+
+class RequestQueue
+{
+public:
+    explicit RequestQueue(size_t limit) : limit(limit) {}
+
+    // Waits while the queue is full.
+    void push(Request &&request)
+    {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [this] { return items.size() < limit; });
+        items.push_back(move(request));
+        notEmpty.notify_one();
+    }
+
+    // False once the queue is closed and empty.
+    bool pop(Request &request)
+    {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return items.size() || closed; });
+        if (items.empty())
+            return false;
+        request = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t limit;
+    deque<Request> items;
+    mutex lock;
+    condition_variable notEmpty, notFull;
+    bool closed = false;
+};
+
+// The threads reading connections, one per connection. Beyond the limit the
+// accept loop waits and new clients wait in the listen backlog.
+class ReaderThreads
+{
+public:
+    explicit ReaderThreads(int limit) : limit(limit) {}
+
+    // Waits while limit connections are being read, and joins the readers that ended.
+    void wait()
+    {
+        vector<thread> ended;
+        {
+            unique_lock<mutex> guard(lock);
+            released.wait(guard, [this] { return readers.size() - finished.size() < limit; });
+            for (int id : finished)
+            {
+                ended.push_back(move(readers[id].reader));
+                readers.erase(id);
+            }
+            finished.clear();
+        }
+        for (thread &reader : ended)
+            reader.join();
+    }
+
+    // Runs read(connection) on a thread of its own.
+    template <class Read>
+    void start(const shared_ptr<Connection> &connection, Read read)
+    {
+        lock_guard<mutex> guard(lock);
+        int id = next++;
+        readers[id].connection = connection;
+        readers[id].reader = thread([this, id, connection, read] {
+            read(connection);
+            lock_guard<mutex> guard(lock);
+            finished.push_back(id);
+            released.notify_one();
+        });
+    }
+
+    // Ends every read still going (what was read is still answered) and joins all the readers.
+    void stop()
+    {
+        vector<thread> all;
+        {
+            lock_guard<mutex> guard(lock);
+            for (auto &[id, reader] : readers)
+            {
+                // Held only while the connection is open, so the descriptor is still its own.
+                if (shared_ptr<Connection> connection = reader.connection.lock())
+                    shutdown(connection->in, SHUT_RD);
+                all.push_back(move(reader.reader));
+            }
+            readers.clear();
+            finished.clear();
+        }
+        for (thread &reader : all)
+            reader.join();
+    }
+
+private:
+    struct Reader
+    {
+        thread reader;
+        weak_ptr<Connection> connection; // Not kept open by this: the answers' requests hold it.
+    };
+
+    size_t limit;
+    int next = 0;
+    map<int, Reader> readers;
+    vector<int> finished; // Readers done, still to join.
+    mutex lock;
+    condition_variable released;
+};
+
+// Buffered lines and byte runs from a file descriptor.
+class StreamReader
+{
+public:
+    explicit StreamReader(int fd) : fd(fd) {}
+
+    // The next line without its newline; false at the end of the stream. A line
+    // longer than limit is skipped up to its newline and comes back empty, with
+    // tooLong set.
+    bool line(string &out, size_t limit, bool &tooLong)
+    {
+        tooLong = false;
+        size_t scanned = 0; // Bytes after pos already searched for the newline.
+        while (true)
+        {
+            size_t end = buffer.find('\n', pos + scanned);
+            if (end != string::npos)
+            {
+                out.assign(buffer, pos, tooLong ? 0 : end - pos);
+                pos = end + 1;
+                return true;
+            }
+            if (buffer.size() - pos > limit)
+            {
+                tooLong = true;
+                buffer.resize(pos); // Only its end matters now.
+            }
+            scanned = buffer.size() - pos;
+            if (!fill())
+            {
+                out.assign(buffer, pos, tooLong ? 0 : string::npos);
+                pos = buffer.size();
+                return tooLong || out.size();
+            }
+        }
+    }
+
+    // Exactly n bytes; false if the stream ends first.
+    bool bytes(size_t n, string &out)
+    {
+        while (buffer.size() - pos < n)
+            if (!fill())
+                return false;
+        out.assign(buffer, pos, n);
+        pos += n;
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        if (pos > 0)
+        {
+            buffer.erase(0, pos);
+            pos = 0;
+        }
+        char chunk[1 << 16];
+        while (true)
+        {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, n);
+            return true;
+        }
+    }
+
+    int fd;
+    string buffer;
+    size_t pos = 0;
+};
+
+void AppendUtf8(string &out, unsigned code)
+{
+    if (code < 0x80)
+        out += char(code);
+    else if (code < 0x800)
+    {
+        out += char(0xc0 | code >> 6);
+        out += char(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        out += char(0xe0 | code >> 12);
+        out += char(0x80 | (code >> 6 & 0x3f));
+        out += char(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        out += char(0xf0 | code >> 18);
+        out += char(0x80 | (code >> 12 & 0x3f));
+        out += char(0x80 | (code >> 6 & 0x3f));
+        out += char(0x80 | (code & 0x3f));
+    }
+}
+
+// A JSON string starting at text[i] (the opening quote); i ends past the closing one.
+bool ParseJsonString(string_view text, size_t &i, string &out)
+{
+    out.clear();
+    for (i++; i < text.size(); i++)
+    {
+        char c = text[i];
+        if (c == '"')
+        {
+            i++;
+            return true;
+        }
+        if (c != '\\')
+        {
+            out += c;
+            continue;
+        }
+        if (++i == text.size())
+            return false;
+        switch (text[i])
+        {
+        case '"': case '\\': case '/': out += text[i]; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u':
+        {
+            auto hex = [&](size_t at, unsigned &code) {
+                return at + 4 <= text.size() &&
+                       from_chars(text.data() + at, text.data() + at + 4, code, 16).ptr == text.data() + at + 4;
+            };
+            unsigned code, low;
+            if (!hex(i + 1, code))
+                return false;
+            i += 4;
+            // A surrogate pair is one character.
+            if (code >= 0xd800 && code < 0xdc00 && i + 2 < text.size() && text[i + 1] == '\\' && text[i + 2] == 'u' &&
+                hex(i + 3, low) && low >= 0xdc00 && low < 0xe000)
+            {
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                i += 6;
+            }
+            AppendUtf8(out, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+// A flat JSON object: string members are decoded, numbers and literals kept as
+// written; nested objects and arrays are refused.
+void ParseJsonRequest(string_view text, Request &request)
+{
+    auto space = [&](size_t &i) {
+        while (i < text.size() && isspace((unsigned char)text[i]))
+            i++;
+    };
+    size_t i = 0;
+    space(i);
+    if (i == text.size() || text[i] != '{')
+    {
+        request.error = "expected a JSON object";
+        return;
+    }
+    i++;
+    space(i);
+    bool hasPedigree = false;
+    string key, value;
+    while (i < text.size() && text[i] != '}')
+    {
+        if (text[i] != '"' || !ParseJsonString(text, i, key))
+        {
+            request.error = "expected a member name";
+            return;
+        }
+        space(i);
+        if (i == text.size() || text[i] != ':')
+        {
+            request.error = "expected ':' after \"" + key + "\"";
+            return;
+        }
+        i++;
+        space(i);
+        bool quoted = i < text.size() && text[i] == '"';
+        if (quoted)
+        {
+            if (!ParseJsonString(text, i, value))
+            {
+                request.error = "bad string for \"" + key + "\"";
+                return;
+            }
+        }
+        else
+        {
+            size_t start = i;
+            while (i < text.size() && text[i] != ',' && text[i] != '}' && !isspace((unsigned char)text[i]))
+                i++;
+            value.assign(text.substr(start, i - start));
+            char *end = nullptr;
+            strtod(value.c_str(), &end);
+            bool literal = value == "true" || value == "false" || value == "null";
+            if (value.empty() || (!literal && (end != value.c_str() + value.size() || !isdigit((unsigned char)value.back()))))
+            {
+                request.error = "\"" + key + "\" must be a string or a number";
+                return;
+            }
+        }
+        if (key == "id")
+            request.id = quoted ? JsonString(value) : value;
+        else if (key == "format")
+            request.format = value;
+        else if (key == "engine")
+            request.engine = value;
+        else if (key == "pedigree")
+        {
+            request.text = move(value);
+            hasPedigree = true;
+        }
+        space(i);
+        if (i < text.size() && text[i] == ',')
+        {
+            i++;
+            space(i);
+        }
+    }
+    if (i == text.size())
+        request.error = "unterminated JSON object";
+    else if (!hasPedigree)
+        request.error = "the request has no \"pedigree\"";
+}
+
+// Reads requests off one stream until it ends; waits whenever the queue is full.
+void ReadRequests(const shared_ptr<Connection> &connection, RequestQueue &queue)
+{
+    StreamReader reader(connection->in);
+    string line;
+    bool tooLong;
+    while (reader.line(line, maxRequestBytes, tooLong))
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos && !tooLong)
+            continue;
+        Request request;
+        request.connection = connection;
+        if (tooLong)
+            request.error = "the request line is longer than " + to_string(maxRequestBytes) + " bytes";
+        else if (line[start] == '{')
+            ParseJsonRequest(string_view(line).substr(start), request);
+        else
+        {
+            size_t bytes = 0;
+            const char *first = line.data() + start, *last = line.data() + line.size();
+            auto parsed = from_chars(first, last, bytes);
+            if (parsed.ec != errc() || (parsed.ptr != last && !isspace((unsigned char)*parsed.ptr)))
+                request.error = "expected a JSON object or a byte count";
+            else if (bytes > maxRequestBytes)
+                request.error = "the pedigree is larger than " + to_string(maxRequestBytes) + " bytes";
+            else
+            {
+                size_t id = line.find_first_not_of(" \t\r", parsed.ptr - line.data());
+                if (id != string::npos)
+                    request.id = JsonString(string_view(line).substr(id, line.find_last_not_of(" \t\r") + 1 - id));
+                if (!reader.bytes(bytes, request.text))
+                {
+                    request.error = "the stream ended inside the pedigree";
+                    queue.push(move(request));
+                    return;
+                }
+            }
+        }
+        queue.push(move(request));
+    }
+}
+
+void Serve(Request &request, PedigreeEngine &engine, const ServerOptions &options)
+{
+    auto start = chrono::steady_clock::now();
+    string error = request.error;
+    string engineName = request.engine.size() ? request.engine : options.engine;
+    McmcReport report;
+    if (error.empty() && request.format.size() && request.format != "ped" && request.format != "csv")
+        error = "unknown format '" + request.format + "'";
+    if (error.empty() && engineName != "forward" && engineName != "peeling" && engineName != "mcmc")
+        error = "unknown engine '" + engineName + "'";
+    if (error.empty() && engine.loadText(request.text, request.format, error))
+    {
+        if (engineName == "forward")
+            engine.analyze();
+        else if (engineName == "peeling")
+            engine.peel(error);
+        else
+            engine.sample(options.mcmc, report, error);
+    }
+
+    string reply = "{\"id\":" + request.id;
+    if (error.size())
+        reply += ",\"error\":" + JsonString(error) + "}\n";
+    else
+    {
+        engine.rankModels();
+        if (options.stats)
+        {
+            options.stats->families++;
+            options.stats->people += engine.size();
+        }
+        reply += ",\"people\":" + to_string(engine.size()) + ",\"best\":\"" + modeCodes[engine.rankedMode(0)] +
+                 "\",\"ranking\":[";
+        for (int i = 0; i < 5; i++)
+            reply += string(i ? "," : "") + "\"" + modeCodes[engine.rankedMode(i)] + "\"";
+        reply += "],\"logLikelihood\":{";
+        char number[32];
+        for (int mode = 0; mode < 5; mode++)
+        {
+            double value = engine.logLikelihoods()[mode];
+            if (value == -INFINITY)
+                snprintf(number, sizeof(number), "null");
+            else
+                snprintf(number, sizeof(number), "%.10g", value);
+            reply += string(mode ? "," : "") + "\"" + modeCodes[mode] + "\":" + number;
+        }
+        snprintf(number, sizeof(number), "%.3f",
+                 chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        reply += "},\"ms\":" + string(number) + "}\n";
+    }
+    request.connection->send(reply);
+}
+
+} // namespace
+
+int RunServer(const ServerOptions &options)
+{
+    RequestQueue queue(max(1, options.queue));
+    vector<thread> workers;
+    for (int i = 0; i < max(1, options.workers); i++)
+        workers.emplace_back([&queue, &options] {
+            PedigreeEngine engine; // Kept for every request this worker serves.
+            engine.setStats(options.stats);
+            engine.setCache(options.cache);
+            engine.setPruneBound(options.pruneBound);
+            Request request;
+            while (queue.pop(request))
+            {
+                Serve(request, engine, options);
+                request = Request(); // Lets go of the connection.
+            }
+        });
+    auto stop = [&] {
+        queue.close();
+        for (thread &worker : workers)
+            worker.join();
+    };
+
+    if (options.endpoint == "-")
+    {
+        ReadRequests(make_shared<Connection>(0, 1), queue);
+        stop();
+        return 0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (options.endpoint.size() >= sizeof(address.sun_path))
+    {
+        cerr << "Error: socket path too long: " << options.endpoint << endl;
+        stop();
+        return 1;
+    }
+    strcpy(address.sun_path, options.endpoint.c_str());
+    // A socket left over from an earlier run goes; anything else at the path stays.
+    struct stat existing;
+    if (lstat(address.sun_path, &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            cerr << "Error: " << options.endpoint << " exists and is not a socket" << endl;
+            stop();
+            return 1;
+        }
+        unlink(address.sun_path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 64) < 0)
+    {
+        cerr << "Error: cannot listen on " << options.endpoint << ": " << strerror(errno) << endl;
+        if (listener >= 0)
+            close(listener);
+        stop();
+        return 1;
+    }
+    cerr << "Serving on " << options.endpoint << endl;
+    ReaderThreads readers(max(1, options.queue));
+    while (true)
+    {
+        readers.wait();
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            cerr << "Error: accept failed: " << strerror(errno) << endl;
+            break;
+        }
+        readers.start(make_shared<Connection>(client, client),
+                      [&queue](const shared_ptr<Connection> &connection) { ReadRequests(connection, queue); });
+    }
+    close(listener);
+    readers.stop(); // The workers still drain the queue, so no reader stays blocked on it.
+    stop();
+    return 1;
+}
@@ -0,0 +1,29 @@
+/*
+    Pedigree Analysis - resident server (--serve).
+*/
+
+#ifndef PEDIGREE_SERVER_H
+#define PEDIGREE_SERVER_H
+
+#include <string>
+
+#include "PedigreeEngine.h"
+
+using namespace std;
+
+struct ServerOptions
+{
+    string endpoint;         // "-" for stdin / stdout, otherwise a Unix socket path.
+    int workers = 1;         // Requests analysed at once, one engine each.
+    int queue = 64;          // Requests read but not yet picked up, and connections read at once.
+    string engine = "forward"; // forward, peeling or mcmc, unless a request says otherwise.
+    McmcOptions mcmc;
+    double pruneBound = INFINITY; // See PedigreeEngine::setPruneBound().
+    FamilyCache *cache = nullptr;
+    PedigreeStats *stats = nullptr;
+};
+
+// Serves until stdin ends (endpoint "-") or, for a socket, until killed.
+int RunServer(const ServerOptions &options);
+
+#endif
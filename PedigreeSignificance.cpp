@@ -0,0 +1,154 @@
+/*
+    Pedigree Analysis - how much the model ranking can be trusted.
+    The ranking alone cannot tell a clear winner from a near tie, so the same
+    pedigree is re-scored with made-up affections, two ways:
+
+    - permutation: the observed affections shuffled over the people. A mode
+      whose observed log-likelihood is rarely reached this way fits the
+      pedigree's structure, not just the number of affected people;
+    - parametric bootstrap: affections simulated under the observed best mode.
+      How often each mode then ranks first says how often the ranking would
+      pick it if it were the truth.
+
+    Replicates only change affections, so they keep the people, the matings
+    and the schedule: each thread copies them once into an engine of its own
+    and re-runs the forward pass on it. Every replicate has a generator seeded
+    from the seed and its index, so results do not depend on the thread count.
+*/
+
+#include "PedigreeEngine.h"
+
+#include <random>
+
+// Everything but the affections, for replicates; the copy keeps the schedule.
+void PedigreeEngine::CopyStructure(const PedigreeEngine &from)
+{
+    AllocatePedigree(from.numOfPeople);
+    gender = from.gender;
+    AffectionFile = from.AffectionFile;
+    Parents = from.Parents;
+    Matings = from.Matings;
+    OffspringStart = from.OffspringStart;
+    Offspring = from.Offspring;
+    BirthMating = from.BirthMating;
+    PersonMatingStart = from.PersonMatingStart;
+    PersonMatings = from.PersonMatings;
+    Headers = from.Headers;
+    MatingOrder = from.MatingOrder;
+    GenerationStart = from.GenerationStart;
+    ScheduleLoaded = true;
+    Cache = from.Cache; // Replicates repeat families even more than batches do.
+    PruneBound = from.PruneBound; // A replicate's -inf must mean what the observed one does.
+}
+
+// States drawn in birth order (uniform founders, Mendelian children), then
+// each person's affection from the penetrance of their state.
+template <class Mode>
+void PedigreeEngine::SimulateAffection(const vector<int> &order, uint64_t seed, vector<unsigned char> &state,
+                                       vector<bool> &affection) const
+{
+    constexpr const ChildStateTable<Mode> &table = childStates<Mode>;
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> uniform(0, 1);
+    state.resize(numOfPeople);
+    affection.resize(numOfPeople);
+    for (int p : order)
+    {
+        int sex = gender[p], states = Mode::sex[sex].states, id = BirthMating[p];
+        double u = uniform(rng);
+        int s = 0;
+        if (id < 0)
+            s = min(states - 1, int(u * states));
+        else
+        {
+            const Mating &parents = Matings[id];
+            while (s < states - 1 && (u -= table.prob[sex][s][state[parents.mother]][state[parents.father]]) >= 0)
+                s++;
+            while (table.prob[sex][s][state[parents.mother]][state[parents.father]] == 0)
+                s--;
+        }
+        state[p] = s;
+        affection[p] = uniform(rng) < Mode::sex[sex].penetrance[s];
+    }
+}
+
+// The mode rankModels() would put first: the highest log-likelihood, ties by name.
+static int BestMode(const double *logLikelihood)
+{
+    int best = 0;
+    for (int mode = 1; mode < 5; mode++)
+        if (logLikelihood[mode] > logLikelihood[best] ||
+            (logLikelihood[mode] == logLikelihood[best] && modeNames[mode] > modeNames[best]))
+            best = mode;
+    return best;
+}
+
+void PedigreeEngine::significance(const SignificanceOptions &options, SignificanceReport &report) const
+{
+    PhaseTimer timer(Stats, PhaseSignificance);
+    int n = numOfPeople, replicates = max(1, options.replicates);
+    vector<int> order;
+    bool fits = false;
+    for (int mode = 0; mode < 5; mode++)
+        fits = fits || Model_Prob[mode] > -INFINITY;
+    report.simulatedMode = fits && BirthOrder(order) ? BestMode(Model_Prob) : -1;
+
+    // Replicate r < replicates is a permutation, the rest bootstrap draws.
+    int total = report.simulatedMode < 0 ? replicates : 2 * replicates;
+    vector<array<double, 5>> scores(total);
+    int engines = Pool ? Pool->size() : 1;
+    vector<PedigreeEngine> replicas(engines);
+    vector<vector<unsigned char>> states(engines);
+    vector<char> ready(engines, 0);
+    parallelFor(total, 16, [&](int begin, int end) {
+        int thread = Pool ? ThreadPool::threadIndex() : 0;
+        PedigreeEngine &replica = replicas[thread];
+        if (!ready[thread])
+        {
+            replica.CopyStructure(*this);
+            ready[thread] = 1;
+        }
+        for (int r = begin; r < end; r++)
+        {
+            uint64_t seed = options.seed + 0x9e3779b97f4a7c15ull * (r + 1);
+            if (r < replicates)
+            {
+                mt19937_64 rng(seed);
+                vector<bool> &affection = replica.AffectionFile;
+                affection = AffectionFile;
+                for (int i = n - 1; i > 0; i--)
+                {
+                    int j = uniform_int_distribution<int>(0, i)(rng);
+                    bool swapped = affection[i];
+                    affection[i] = affection[j];
+                    affection[j] = swapped;
+                }
+            }
+            else
+                Modes::forEach([&](auto mode) {
+                    typedef decltype(mode) Mode;
+                    if (Mode::id == report.simulatedMode)
+                        SimulateAffection<Mode>(order, seed, states[thread], replica.AffectionFile);
+                });
+            replica.analyze();
+            copy(replica.Model_Prob, replica.Model_Prob + 5, scores[r].begin());
+        }
+    });
+
+    // Add-one p-values: the observed pedigree counts as one of the permutations.
+    for (int mode = 0; mode < 5; mode++)
+    {
+        int reached = 0;
+        for (int r = 0; r < replicates; r++)
+            reached += scores[r][mode] >= Model_Prob[mode];
+        report.permutationP[mode] = Model_Prob[mode] == -INFINITY ? 1 : (reached + 1.0) / (replicates + 1.0);
+        report.selected[mode] = 0;
+    }
+    // A replicate no mode fits (the forward pass can miss) counts for none.
+    for (int r = replicates; r < total; r++)
+    {
+        int best = BestMode(scores[r].data());
+        if (scores[r][best] > -INFINITY)
+            report.selected[best] += 1.0 / replicates;
+    }
+}
@@ -0,0 +1,286 @@
+/*
+    Pedigree Analysis - binary pedigree snapshots.
+    A snapshot is the loaded pedigree plus its mating schedule, laid out as flat
+    arrays behind a fixed header, so a later run maps the file and copies the
+    arrays instead of parsing the input and rebuilding the schedule. The file is
+    mapped read-only: person IDs are used in place, and processes loading the
+    same snapshot share its pages.
+
+    Layout: the header, then every section in SnapshotSection order, each at an
+    8-byte aligned offset. Integers are in the writer's byte order; a snapshot
+    from a machine with the other byte order is refused, not converted.
+*/
+
+#include "PedigreeEngine.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+const char snapshotMagic[8] = {'P', 'E', 'D', 'S', 'N', 'A', 'P', '\n'};
+const uint32_t snapshotVersion = 3; // 2: offspring per mating instead of children per person. 3: reached matings only in the order.
+const uint32_t snapshotByteOrder = 0x01020304;
+
+enum SnapshotSection
+{
+    SectionSex,                // Bitset, 1 if female.
+    SectionAffection,          // Bitset, 1 if affected.
+    SectionParents,            // int32 mother, father per person; -1 for founders.
+    SectionPartner,            // int32 per person, -1 if none.
+    SectionHeaders,            // int32 founders, in load order.
+    SectionMatings,            // int32 mother, father per mating.
+    SectionOffspringStart,     // int32 per mating + 1: CSR offsets into SectionOffspring.
+    SectionOffspring,          // int32
+    SectionMatingOrder,        // int32, wave by wave; only the matings the schedule reaches.
+    SectionGenerationStart,    // int32 per wave + 1.
+    SectionMatingWave,         // int32 per mating, -1 if never reached.
+    SectionPersonMatingStart,  // int32 per person + 1: CSR offsets into SectionPersonMatings.
+    SectionPersonMatings,      // int32
+    SectionResolved,           // Bitset, 1 if the schedule resolves the person.
+    SectionIdStart,            // int64 per person + 1: offsets into SectionIds.
+    SectionIds,                // Person IDs, back to back.
+    SectionCount
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version, byteOrder;
+    uint64_t fileSize;
+    int64_t people, founders, matings, ordered, waves, offspring, idBytes;
+    uint64_t section[SectionCount][2]; // Offset and size in bytes.
+};
+
+static_assert(sizeof(int) == sizeof(int32_t), "snapshots store the engine's ints as int32");
+
+static size_t BitsetBytes(int64_t bits)
+{
+    return (bits + 63) / 64 * sizeof(uint64_t);
+}
+
+static bool TestBit(const uint64_t *bits, int i)
+{
+    return bits[i >> 6] >> (i & 63) & 1;
+}
+
+// What every section must hold for the counts in the header.
+static void SectionSizes(const SnapshotHeader &header, uint64_t (&bytes)[SectionCount])
+{
+    int64_t n = header.people, m = header.matings;
+    bytes[SectionSex] = bytes[SectionAffection] = bytes[SectionResolved] = BitsetBytes(n);
+    bytes[SectionParents] = 2 * n * sizeof(int32_t);
+    bytes[SectionPartner] = n * sizeof(int32_t);
+    bytes[SectionIdStart] = (n + 1) * sizeof(int64_t);
+    bytes[SectionOffspringStart] = (m + 1) * sizeof(int32_t);
+    bytes[SectionOffspring] = header.offspring * sizeof(int32_t);
+    bytes[SectionHeaders] = header.founders * sizeof(int32_t);
+    bytes[SectionMatings] = 2 * m * sizeof(int32_t);
+    bytes[SectionMatingOrder] = header.ordered * sizeof(int32_t);
+    bytes[SectionMatingWave] = m * sizeof(int32_t);
+    bytes[SectionGenerationStart] = header.waves * sizeof(int32_t);
+    bytes[SectionPersonMatingStart] = (n + 1) * sizeof(int32_t);
+    bytes[SectionPersonMatings] = 2 * m * sizeof(int32_t);
+    bytes[SectionIds] = header.idBytes;
+}
+
+bool PedigreeEngine::saveSnapshot(const string &path, string &error)
+{
+    if (!ScheduleLoaded)
+        BuildSchedule();
+
+    int n = numOfPeople;
+    vector<uint64_t> sex(BitsetBytes(n) / 8), affection(sex.size()), resolved(sex.size());
+    vector<int32_t> parents(2 * n), matings(2 * Matings.size());
+    vector<int64_t> idStart(n + 1, 0);
+    string ids;
+    for (int i = 0; i < n; i++)
+    {
+        sex[i >> 6] |= (uint64_t)(gender[i] != 0) << (i & 63);
+        affection[i >> 6] |= (uint64_t)AffectionFile[i] << (i & 63);
+        resolved[i >> 6] |= (uint64_t)(Resolved[i] != 0) << (i & 63);
+        parents[2 * i] = Parents[i].first;
+        parents[2 * i + 1] = Parents[i].second;
+        if (PersonID.size())
+            ids.append(PersonID[i]);
+        idStart[i + 1] = ids.size();
+    }
+    for (size_t k = 0; k < Matings.size(); k++)
+    {
+        matings[2 * k] = Matings[k].mother;
+        matings[2 * k + 1] = Matings[k].father;
+    }
+
+    const void *data[SectionCount] = {sex.data(), affection.data(), parents.data(), Partner.data(),
+                                      Headers.data(), matings.data(), OffspringStart.data(), Offspring.data(),
+                                      MatingOrder.data(), GenerationStart.data(), MatingWave.data(),
+                                      PersonMatingStart.data(), PersonMatings.data(), resolved.data(),
+                                      idStart.data(), ids.data()};
+    SnapshotHeader header = {};
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version = snapshotVersion;
+    header.byteOrder = snapshotByteOrder;
+    header.people = n;
+    header.founders = Headers.size();
+    header.matings = Matings.size();
+    header.ordered = MatingOrder.size(); // Fewer than the matings when a parent cycle is never reached.
+    header.waves = GenerationStart.size();
+    header.offspring = Offspring.size();
+    header.idBytes = ids.size();
+    uint64_t bytes[SectionCount];
+    SectionSizes(header, bytes);
+    uint64_t offset = (sizeof(header) + 7) & ~7ULL;
+    for (int s = 0; s < SectionCount; s++)
+    {
+        header.section[s][0] = offset;
+        header.section[s][1] = bytes[s];
+        offset = (offset + bytes[s] + 7) & ~7ULL;
+    }
+    header.fileSize = offset;
+
+    // Written next to the target and renamed over it, so a reader never maps half a snapshot.
+    string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+    {
+        error = "cannot write " + temporary + ": " + strerror(errno);
+        return false;
+    }
+    static const char padding[8] = {};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(header);
+    for (int s = 0; s < SectionCount && written; s++)
+    {
+        written = fwrite(padding, 1, header.section[s][0] - position, file) == header.section[s][0] - position &&
+                  fwrite(data[s], 1, bytes[s], file) == bytes[s];
+        position = header.section[s][0] + bytes[s];
+    }
+    written = written && fwrite(padding, 1, header.fileSize - position, file) == header.fileSize - position;
+    if (fclose(file) != 0 || !written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        error = "cannot write " + path + ": " + strerror(errno);
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PedigreeEngine::loadSnapshot(const string &path, string &error)
+{
+    Rows.clear(); // No text to read traits from.
+    if (!ReadInput(path, Source, error))
+        return false;
+    SnapshotHeader header;
+    if (Source.size < sizeof(header) || memcmp(Source.data, snapshotMagic, sizeof(snapshotMagic)) != 0)
+    {
+        error = path + " is not a pedigree snapshot";
+        return false;
+    }
+    memcpy(&header, Source.data, sizeof(header));
+    if (header.version != snapshotVersion)
+    {
+        error = path + ": snapshot version " + to_string(header.version) + ", this build reads version " +
+                to_string(snapshotVersion);
+        return false;
+    }
+    if (header.byteOrder != snapshotByteOrder)
+    {
+        error = path + ": snapshot written with a different byte order";
+        return false;
+    }
+
+    uint64_t bytes[SectionCount];
+    bool valid = header.fileSize == Source.size && header.people >= 0 && header.people < INT32_MAX &&
+                 header.matings >= 0 && header.matings < INT32_MAX && header.ordered >= 0 &&
+                 header.ordered <= header.matings && header.founders >= 0 &&
+                 header.founders <= header.people && header.waves >= 1 && header.offspring >= 0 &&
+                 header.idBytes >= 0;
+    if (valid)
+        SectionSizes(header, bytes);
+    for (int s = 0; s < SectionCount && valid; s++)
+        valid = header.section[s][0] % 8 == 0 && header.section[s][1] == bytes[s] &&
+                header.section[s][0] <= Source.size && bytes[s] <= Source.size - header.section[s][0];
+    if (!valid)
+    {
+        error = path + ": truncated or corrupt snapshot";
+        return false;
+    }
+    auto section = [&](SnapshotSection s) { return Source.data + header.section[s][0]; };
+    const uint64_t *sex = (const uint64_t *)section(SectionSex), *affection = (const uint64_t *)section(SectionAffection);
+    const uint64_t *resolved = (const uint64_t *)section(SectionResolved);
+    const int32_t *parents = (const int32_t *)section(SectionParents), *partner = (const int32_t *)section(SectionPartner);
+    const int64_t *idStart = (const int64_t *)section(SectionIdStart);
+    const int32_t *headers = (const int32_t *)section(SectionHeaders), *matings = (const int32_t *)section(SectionMatings);
+    const int32_t *offspringStart = (const int32_t *)section(SectionOffspringStart);
+    const int32_t *offspring = (const int32_t *)section(SectionOffspring);
+    const int32_t *matingOrder = (const int32_t *)section(SectionMatingOrder);
+    const int32_t *generationStart = (const int32_t *)section(SectionGenerationStart);
+    const int32_t *matingWave = (const int32_t *)section(SectionMatingWave);
+    const int32_t *personMatingStart = (const int32_t *)section(SectionPersonMatingStart);
+    const int32_t *personMatings = (const int32_t *)section(SectionPersonMatings);
+    const char *ids = section(SectionIds);
+
+    // Every index is checked once, so a damaged file fails here and not in the analysis.
+    int n = header.people, m = header.matings;
+    auto person = [n](int64_t i) { return i >= -1 && i < n; };
+    auto offsets = [](const auto *start, int count, int64_t total) {
+        if (start[0] != 0 || start[count] != total)
+            return false;
+        for (int i = 0; i < count; i++)
+            if (start[i] > start[i + 1])
+                return false;
+        return true;
+    };
+    valid = offsets(offspringStart, m, header.offspring) && offsets(idStart, n, header.idBytes) &&
+            offsets(personMatingStart, n, 2 * m) && offsets(generationStart, header.waves - 1, header.ordered);
+    for (int64_t i = 0; i < 2 * (int64_t)n && valid; i++)
+        valid = person(parents[i]) && (i >= n || person(partner[i]));
+    for (int64_t i = 0; i < header.offspring && valid; i++)
+        valid = offspring[i] >= 0 && offspring[i] < n;
+    for (int64_t i = 0; i < header.founders && valid; i++)
+        valid = headers[i] >= 0 && headers[i] < n;
+    for (int64_t i = 0; i < 2 * (int64_t)m && valid; i++)
+        valid = matings[i] >= 0 && matings[i] < n && personMatings[i] >= 0 && personMatings[i] < m &&
+                (i >= m || (matingWave[i] >= -1 && matingWave[i] < header.waves - 1));
+    for (int64_t i = 0; i < header.ordered && valid; i++)
+        valid = matingOrder[i] >= 0 && matingOrder[i] < m;
+    if (!valid)
+    {
+        error = path + ": corrupt snapshot";
+        return false;
+    }
+
+    AllocatePedigree(n);
+    gender.resize(n);
+    AffectionFile.resize(n);
+    Parents.resize(n);
+    PersonID.resize(n);
+    Resolved.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        gender[i] = TestBit(sex, i);
+        AffectionFile[i] = TestBit(affection, i);
+        Resolved[i] = TestBit(resolved, i);
+        Parents[i] = {parents[2 * i], parents[2 * i + 1]};
+        PersonID[i] = string_view(ids + idStart[i], idStart[i + 1] - idStart[i]);
+    }
+    Partner.assign(partner, partner + n);
+    Headers.assign(headers, headers + header.founders);
+
+    Matings.resize(m);
+    for (int k = 0; k < m; k++)
+        Matings[k] = {matings[2 * k], matings[2 * k + 1]};
+    OffspringStart.assign(offspringStart, offspringStart + m + 1);
+    Offspring.assign(offspring, offspring + header.offspring);
+    BirthMating.assign(n, -1);
+    for (int k = 0; k < m; k++)
+        for (int c = OffspringStart[k]; c < OffspringStart[k + 1]; c++)
+            BirthMating[Offspring[c]] = k;
+    MatingOrder.assign(matingOrder, matingOrder + header.ordered);
+    GenerationStart.assign(generationStart, generationStart + header.waves);
+    MatingWave.assign(matingWave, matingWave + m);
+    PersonMatingStart.assign(personMatingStart, personMatingStart + n + 1);
+    PersonMatings.assign(personMatings, personMatings + 2 * m);
+    DirtyMarker.assign(m, 0);
+    ScheduleLoaded = true;
+    return true;
+}
@@ -0,0 +1,156 @@
+/*
+    Pedigree Analysis - run statistics (--stats).
+    Phase timers and counters are only touched through a PedigreeStats pointer;
+    when it is null (the default) nothing is timed or counted.
+*/
+
+#ifndef PEDIGREE_STATS_H
+#define PEDIGREE_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/resource.h>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+/*
+    Heap allocations, counted by the replacement operator new of the program
+    that wants them (the CLI); they stay at zero anywhere else. Per thread, so a
+    phase counts only what its own thread allocated.
+*/
+inline atomic<bool> heapCounting{false};
+inline atomic<long long> heapAllocations{0}, heapBytes{0};
+inline thread_local long long threadAllocations = 0;
+
+enum StatsPhase
+{
+    PhaseInput,
+    PhaseExport,
+    PhasePrepare,
+    PhasePropagate,
+    PhaseScore,
+    PhaseEdit,
+    PhaseSweep,
+    PhasePeel,
+    PhaseSample,
+    PhasePosteriors,
+    PhaseSignificance,
+    PhaseTraits,
+    PhaseOutput,
+    PhaseCount
+};
+const char *const statsPhaseNames[PhaseCount] = {
+    "input",
+    "export",
+    "prepare",
+    "propagate",
+    "score",
+    "edit",
+    "sweep",
+    "peel",
+    "sample",
+    "posteriors",
+    "significance",
+    "traits",
+    "output",
+};
+
+struct PedigreeStats
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    // Nanoseconds per phase; in batch mode, summed over the threads.
+    atomic<long long> phaseTime[PhaseCount] = {};
+    atomic<long long> phaseAllocations[PhaseCount] = {};
+    atomic<long long> families{0}, people{0};
+    atomic<long long> founders{0};    // PedStarters calls.
+    atomic<long long> matings{0};     // Matings scored.
+    atomic<long long> children{0};    // Children propagated.
+    atomic<long long> zeroFactors{0}; // Founder / mating factors of log(0), which zero their mode.
+    atomic<long long> prunedModes{0}; // Modes the forward pass stopped following part way.
+    long long cacheHits = 0, cacheMisses = 0, cacheEvictions = 0; // --cache, filled in at the end.
+
+    string json(const ThreadPool *pool) const
+    {
+        char buffer[96];
+        string out = "{\"phases\":{";
+        for (int phase = 0; phase < PhaseCount; phase++)
+        {
+            snprintf(buffer, sizeof(buffer), "%s\"%s\":%.9g", phase ? "," : "", statsPhaseNames[phase],
+                     phaseTime[phase] * 1e-9);
+            out += buffer;
+        }
+        snprintf(buffer, sizeof(buffer), ",\"total\":%.9g},",
+                 chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        out += buffer;
+
+        out += "\"counters\":{"
+               "\"families\":" + to_string(families) +
+               ",\"people\":" + to_string(people) +
+               ",\"founders\":" + to_string(founders) +
+               ",\"matings\":" + to_string(matings) +
+               ",\"children\":" + to_string(children) +
+               ",\"zeroFactors\":" + to_string(zeroFactors) +
+               ",\"prunedModes\":" + to_string(prunedModes) +
+               ",\"cacheHits\":" + to_string(cacheHits) +
+               ",\"cacheMisses\":" + to_string(cacheMisses) +
+               ",\"cacheEvictions\":" + to_string(cacheEvictions) + "},";
+
+        snprintf(buffer, sizeof(buffer), "\"allocations\":{\"total\":%lld,\"bytes\":%lld,\"phases\":{",
+                 heapAllocations.load(), heapBytes.load());
+        out += buffer;
+        for (int phase = 0; phase < PhaseCount; phase++)
+        {
+            snprintf(buffer, sizeof(buffer), "%s\"%s\":%lld", phase ? "," : "", statsPhaseNames[phase],
+                     phaseAllocations[phase].load());
+            out += buffer;
+        }
+        out += "}},";
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        out += "\"peakRssKb\":" + to_string(usage.ru_maxrss) + ",\"threadBusy\":[";
+        for (int thread = 0; pool && thread < pool->size(); thread++)
+        {
+            snprintf(buffer, sizeof(buffer), "%s%.9g", thread ? "," : "", pool->busySeconds(thread));
+            out += buffer;
+        }
+        out += "]}\n";
+        return out;
+    }
+};
+
+// Adds the lifetime of the scope to a phase; free when stats are off.
+class PhaseTimer
+{
+public:
+    PhaseTimer(PedigreeStats *stats, StatsPhase phase) : stats(stats), phase(phase)
+    {
+        if (stats)
+        {
+            start = chrono::steady_clock::now();
+            allocations = threadAllocations;
+        }
+    }
+
+    ~PhaseTimer()
+    {
+        if (stats)
+        {
+            stats->phaseTime[phase] +=
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            stats->phaseAllocations[phase] += threadAllocations - allocations;
+        }
+    }
+
+private:
+    PedigreeStats *stats;
+    StatsPhase phase;
+    chrono::steady_clock::time_point start;
+    long long allocations = 0;
+};
+
+#endif
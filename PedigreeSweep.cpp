@@ -0,0 +1,31 @@
+/*
+    Pedigree Analysis - parameter sweeps.
+    Every grid point (allele frequency q, penetrance f, phenocopy rate p) is a
+    lane of one traversal (PedigreeLanes.cpp). The model is the engine's,
+    generalised:
+
+    - founders are in Hardy-Weinberg equilibrium for q, or uniform as in the
+      usual analysis when q is NaN (--sweep-q uniform);
+    - a state the mode calls affected shows the trait with probability f,
+      any other state with probability p (with uniform founders, f = 1 and
+      p = 0 give the usual analysis).
+
+    The lanes share the traversal, the schedule and the power tables, but
+    every point still has genes of its own to propagate: a point costs a
+    quarter to a third of an analysis, so a large grid is far from free.
+*/
+
+#include "PedigreeEngine.h"
+
+// Lanes per traversal at most: wider blocks no longer fit a family's genes in
+// cache and only add traffic.
+const int maxSweepLanes = 8;
+
+int PedigreeEngine::sweep(const SweepGrid &grid, vector<array<double, 5>> &surface, size_t memoryBytes)
+{
+    PhaseTimer timer(Stats, PhaseSweep);
+    vector<LanePoint> points(grid.size());
+    for (size_t k = 0; k < points.size(); k++)
+        grid.point(k, points[k].q, points[k].penetrance, points[k].phenocopy);
+    return RunLanes(points, maxSweepLanes, memoryBytes, surface);
+}
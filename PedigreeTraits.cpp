@@ -0,0 +1,39 @@
+/*
+    Pedigree Analysis - many traits on one pedigree.
+    Related conditions, or one condition under several affection definitions,
+    are tested on the same family structure. The affection column and the
+    trait columns of the input (--trait-columns, or a CSV header's) are each a
+    trait, kept as one bit per person, and every trait is a lane of one
+    traversal (PedigreeLanes.cpp), as grid points are for the sweep. A lane
+    computes what analyze() does for its trait alone: only the affections
+    differ between lanes, never the model.
+*/
+
+#include "PedigreeEngine.h"
+
+// Lanes per traversal at most. A pass follows a mode while any of its lanes
+// can still have it, and wider passes only add memory: 4 lanes scored 64
+// traits of 345k people in half the time 16 did.
+const int maxTraitLanes = 4;
+
+bool PedigreeEngine::loadTraits(const string &format, int first, int count, string &error)
+{
+    if ((int)Rows.size() != numOfPeople)
+    {
+        error = "traits are read from the input text; a snapshot or an interactive pedigree has none";
+        return false;
+    }
+    if (!ParseTraits(Source.text(), format, first, count, Rows, TraitNames, TraitBits, error))
+        return false;
+    TraitWords = (TraitNames.size() + 63) / 64;
+    return true;
+}
+
+int PedigreeEngine::analyzeTraits(vector<array<double, 5>> &matrix, size_t memoryBytes)
+{
+    PhaseTimer timer(Stats, PhaseTraits);
+    vector<LanePoint> points(TraitNames.size());
+    for (size_t trait = 0; trait < points.size(); trait++)
+        points[trait].trait = trait;
+    return RunLanes(points, maxTraitLanes, memoryBytes, matrix);
+}
@@ -0,0 +1,128 @@
+/*
+    Pedigree Analysis - a small persistent thread pool.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threads)
+    {
+        busyTime.assign(threads, 0);
+        for (int i = 1; i < threads; i++)
+            workers.emplace_back([this, i] { work(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+    }
+
+    int size() const { return workers.size() + 1; }
+    // The calling thread's number in [0, size()): 0 for the caller of parallelFor.
+    static int threadIndex() { return currentThread; }
+
+    // Busy time accounting, per thread (0 is the caller). Off unless enabled.
+    void trackBusyTime() { tracking = true; }
+    double busySeconds(int thread) const { return busyTime[thread] * 1e-9; }
+
+    // Runs body(begin, end) over [0, n) in chunks of `grain`, the caller included.
+    void parallelFor(int n, int grain, const function<void(int, int)> &body)
+    {
+        if (workers.empty() || n <= grain)
+        {
+            if (n > 0)
+            {
+                auto start = Now();
+                body(0, n);
+                Account(0, start);
+            }
+            return;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            job = &body;
+            total = n;
+            chunk = grain;
+            next = 0;
+            busy = workers.size();
+            round++;
+        }
+        wake.notify_all();
+        runChunks(0);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this] { return busy == 0; });
+    }
+
+private:
+    chrono::steady_clock::time_point Now() const
+    {
+        return tracking ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+    }
+
+    void Account(int thread, chrono::steady_clock::time_point start)
+    {
+        if (tracking)
+            busyTime[thread] += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+    void runChunks(int thread)
+    {
+        auto start = Now();
+        for (int begin = next.fetch_add(chunk); begin < total; begin = next.fetch_add(chunk))
+            (*job)(begin, min(total, begin + chunk));
+        Account(thread, start);
+    }
+
+    void work(int thread)
+    {
+        currentThread = thread;
+        long seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [&] { return stopping || round != seen; });
+            if (stopping)
+                return;
+            seen = round;
+            guard.unlock();
+            runChunks(thread);
+            guard.lock();
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, finished;
+    const function<void(int, int)> *job = nullptr;
+    int total = 0, chunk = 1, busy = 0;
+    atomic<int> next{0};
+    long round = 0;
+    bool stopping = false;
+    bool tracking = false;
+    vector<long long> busyTime; // Nanoseconds; each thread only writes its own slot.
+    inline static thread_local int currentThread = 0;
+};
+
+#endif
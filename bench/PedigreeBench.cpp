@@ -0,0 +1,270 @@
+/*
+    Pedigree Analysis - benchmark harness.
+    Times ingestion, propagation, scoring and DOT export on synthetic pedigrees
+    of growing size, and saves or checks a JSON baseline.
+
+    Build (from the repository root):
+        g++ -O2 -std=c++17 -pthread -I. -o pedigree-bench bench/PedigreeBench.cpp \
+            PedigreeEngine.cpp PedigreeExport.cpp
+
+    Examples:
+        pedigree-bench --sizes 10,1000,100000,1000000 --save baseline.json
+        pedigree-bench --baseline baseline.json --tolerance 0.25
+        pedigree-bench --generate 50000 --mode AR > synthetic.ped
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#include "PedigreeEngine.h"
+#include "bench/PedigreeGenerator.h"
+
+using namespace std;
+
+const char *const phaseNames[4] = {"ingest", "propagate", "score", "export"};
+
+struct BenchResult
+{
+    long long people;
+    double seconds[4]; // Best of the repeats, per phase.
+    long peakRssKb;
+};
+
+long PeakRssKb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // Kilobytes on Linux.
+}
+
+BenchResult RunSize(long long people, GeneratorOptions options, int repeats, ThreadPool &pool, const string &dotPath)
+{
+    options.people = people;
+    string text = GeneratePedigree(options);
+
+    BenchResult result{people, {1e300, 1e300, 1e300, 1e300}, 0};
+    PedigreeEngine engine;
+    engine.setThreadPool(&pool);
+    for (int r = 0; r < repeats; r++)
+    {
+        string error;
+        double seconds[4];
+        auto last = chrono::steady_clock::now();
+        auto lap = [&last]() {
+            auto now = chrono::steady_clock::now();
+            double elapsed = chrono::duration<double>(now - last).count();
+            last = now;
+            return elapsed;
+        };
+
+        if (!engine.loadText(text, "ped", error))
+        {
+            cerr << "Error: " << error << endl;
+            exit(1);
+        }
+        seconds[0] = lap();
+        engine.prepare();
+        engine.propagate();
+        seconds[1] = lap();
+        engine.score();
+        seconds[2] = lap();
+        if (!engine.exportGraph(dotPath, ExportDot, false, error))
+        {
+            cerr << "Error: " << error << endl;
+            exit(1);
+        }
+        seconds[3] = lap();
+
+        for (int phase = 0; phase < 4; phase++)
+            result.seconds[phase] = min(result.seconds[phase], seconds[phase]);
+    }
+    remove(dotPath.c_str());
+    result.peakRssKb = PeakRssKb();
+    return result;
+}
+
+// One result per line, so a baseline is easy to diff and to read back.
+void SaveBaseline(const string &path, const vector<BenchResult> &results, int threads)
+{
+    ofstream out(path);
+    out << "{\"version\":1,\"threads\":" << threads << ",\"results\":[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        out << "{\"people\":" << r.people;
+        for (int phase = 0; phase < 4; phase++)
+            out << ",\"" << phaseNames[phase] << "\":" << r.seconds[phase];
+        out << ",\"peakRssKb\":" << r.peakRssKb << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+}
+
+bool LoadBaseline(const string &path, vector<BenchResult> &results)
+{
+    ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    while (getline(in, line))
+    {
+        BenchResult r;
+        if (sscanf(line.c_str(), "{\"people\":%lld,\"ingest\":%lf,\"propagate\":%lf,\"score\":%lf,\"export\":%lf,\"peakRssKb\":%ld",
+                   &r.people, &r.seconds[0], &r.seconds[1], &r.seconds[2], &r.seconds[3], &r.peakRssKb) == 6)
+            results.push_back(r);
+    }
+    return true;
+}
+
+void PrintUsage(const char *program)
+{
+    cout << "Usage: " << program << " [--sizes N,N,...] [--repeat N] [--threads N] [generator options]" << endl;
+    cout << "       " << string(strlen(program), ' ') << " [--save <baseline.json>] [--baseline <baseline.json> [--tolerance F]]" << endl;
+    cout << "       " << program << " --generate N [generator options] > pedigree.ped" << endl;
+    cout << "  --sizes          People per run (default: 10,1000,100000,1000000; up to 10M is fine)." << endl;
+    cout << "  --repeat         Runs per size; the fastest is kept (default: 3)." << endl;
+    cout << "  --save           Write the results as a JSON baseline." << endl;
+    cout << "  --baseline       Compare against a saved baseline; exit 1 on a regression." << endl;
+    cout << "  --tolerance      Allowed slowdown per phase before it counts (default: 0.2 = 20%)." << endl;
+    cout << "  --dot            Scratch file for the export phase (default: pedigree-bench.dot)." << endl;
+    cout << "Generator options:" << endl;
+    cout << "  --seed N  --generations N  --sibship-mean F  --sibship-max N  --marriage-rate F" << endl;
+    cout << "  --mode AD|AR|XLD|XLR|YL  --allele-freq F  --penetrance F  --phenocopy F" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    GeneratorOptions options;
+    vector<long long> sizes = {10, 1000, 100000, 1000000};
+    int repeats = 3, threads = max(1u, thread::hardware_concurrency());
+    long long generate = 0;
+    double tolerance = 0.2;
+    string savePath, baselinePath, dotPath = "pedigree-bench.dot";
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue)
+        {
+            sizes.clear();
+            stringstream list(argv[++i]);
+            string size;
+            while (getline(list, size, ','))
+                sizes.push_back(atoll(size.c_str()));
+        }
+        else if (arg == "--repeat" && hasValue)
+            repeats = max(1, atoi(argv[++i]));
+        else if (arg == "--threads" && hasValue)
+            threads = max(1, atoi(argv[++i]));
+        else if (arg == "--save" && hasValue)
+            savePath = argv[++i];
+        else if (arg == "--baseline" && hasValue)
+            baselinePath = argv[++i];
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = atof(argv[++i]);
+        else if (arg == "--dot" && hasValue)
+            dotPath = argv[++i];
+        else if (arg == "--generate" && hasValue)
+            generate = atoll(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--generations" && hasValue)
+            options.generations = atoi(argv[++i]);
+        else if (arg == "--sibship-mean" && hasValue)
+            options.sibshipMean = atof(argv[++i]);
+        else if (arg == "--sibship-max" && hasValue)
+            options.sibshipMax = atoi(argv[++i]);
+        else if (arg == "--marriage-rate" && hasValue)
+            options.marriageRate = atof(argv[++i]);
+        else if (arg == "--allele-freq" && hasValue)
+            options.alleleFreq = atof(argv[++i]);
+        else if (arg == "--penetrance" && hasValue)
+            options.penetrance = atof(argv[++i]);
+        else if (arg == "--phenocopy" && hasValue)
+            options.phenocopy = atof(argv[++i]);
+        else if (arg == "--mode" && hasValue)
+        {
+            string code = argv[++i];
+            options.mode = find(modeCodes, modeCodes + 5, code) - modeCodes;
+            if (options.mode == 5)
+            {
+                cerr << "Unknown mode: " << code << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            PrintUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "Unknown option: " << arg << endl;
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (generate)
+    {
+        options.people = generate;
+        cout << GeneratePedigree(options);
+        return 0;
+    }
+
+    ThreadPool pool(threads);
+    vector<BenchResult> results;
+    printf("%10s %12s %12s %12s %12s %14s %10s\n", "people", "ingest/s", "propagate/s", "score/s", "export/s",
+           "total people/s", "peak MB");
+    for (long long people : sizes)
+    {
+        BenchResult r = RunSize(people, options, repeats, pool, dotPath);
+        double total = 0;
+        printf("%10lld", r.people);
+        for (int phase = 0; phase < 4; phase++)
+        {
+            printf(" %12.4g", r.people / max(r.seconds[phase], 1e-9));
+            total += r.seconds[phase];
+        }
+        printf(" %14.4g %10.1f\n", r.people / max(total, 1e-9), r.peakRssKb / 1024.0);
+        results.push_back(r);
+    }
+
+    if (savePath.size())
+        SaveBaseline(savePath, results, threads);
+
+    int regressions = 0;
+    if (baselinePath.size())
+    {
+        vector<BenchResult> baseline;
+        if (!LoadBaseline(baselinePath, baseline))
+        {
+            cerr << "Error: cannot read " << baselinePath << endl;
+            return 1;
+        }
+        for (const BenchResult &b : baseline)
+            for (const BenchResult &r : results)
+            {
+                if (r.people != b.people)
+                    continue;
+                for (int phase = 0; phase < 4; phase++)
+                    if (r.seconds[phase] > b.seconds[phase] * (1 + tolerance) && r.seconds[phase] - b.seconds[phase] > 1e-3)
+                    {
+                        printf("REGRESSION %lld people, %s: %.4g s -> %.4g s\n", r.people, phaseNames[phase],
+                               b.seconds[phase], r.seconds[phase]);
+                        regressions++;
+                    }
+            }
+        printf("%d regression(s) against %s\n", regressions, baselinePath.c_str());
+    }
+    return regressions ? 1 : 0;
+}
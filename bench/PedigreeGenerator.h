@@ -0,0 +1,133 @@
+/*
+    Pedigree Analysis - seeded synthetic pedigrees for benchmarking.
+    Families grow from one founder couple, generation by generation; a disease
+    allele is dropped through them under the chosen mode and affection status
+    follows from the genotype, the penetrance and the phenocopy rate.
+*/
+
+#ifndef PEDIGREE_GENERATOR_H
+#define PEDIGREE_GENERATOR_H
+
+#include <charconv>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct GeneratorOptions
+{
+    long long people = 1000;   // Stop once this many people are written.
+    int generations = 4;       // Generations below the founder couple.
+    double sibshipMean = 2.5;  // Children per couple ~ Poisson(sibshipMean)...
+    int sibshipMax = 12;       // ... capped here.
+    double marriageRate = 0.7; // Chance a child marries in someone from outside.
+    int mode = 0;              // 0 AD, 1 AR, 2 XLD, 3 XLR, 4 YL
+    double alleleFreq = 0.05;  // Disease allele frequency in founders.
+    double penetrance = 1;     // P(affected | disease genotype)
+    double phenocopy = 0;      // P(affected | other genotypes)
+    uint64_t seed = 1;
+};
+
+// The pedigree in PED format: fam id father mother sex(1=M, 2=F) aff(2=aff, 1=unaff).
+inline string GeneratePedigree(const GeneratorOptions &options)
+{
+    mt19937_64 rng(options.seed);
+    uniform_real_distribution<double> uniform(0, 1);
+    poisson_distribution<int> sibshipSize(options.sibshipMean);
+    auto chance = [&](double p) { return uniform(rng) < p; };
+
+    struct Person
+    {
+        int father, mother;
+        bool female;
+        unsigned char alleles; // Disease alleles carried (X and Y count for males).
+    };
+    vector<Person> family;
+    vector<pair<int, int>> couples, nextCouples;
+
+    string text;
+    text.reserve(options.people * 24);
+    char number[24];
+    auto put = [&](long long value) { text.append(number, to_chars(number, number + sizeof(number), value).ptr); };
+
+    long long written = 0;
+    for (long long fam = 1; written < options.people; fam++)
+    {
+        family.clear();
+        auto founder = [&](bool female) {
+            Person p{-1, -1, female, 0};
+            if (options.mode <= 1 || (options.mode <= 3 && female))
+                p.alleles = chance(options.alleleFreq) + chance(options.alleleFreq);
+            else if (options.mode <= 3 || !female)
+                p.alleles = chance(options.alleleFreq);
+            family.push_back(p);
+            return (int)family.size() - 1;
+        };
+        auto child = [&](int mother, int father, bool female) {
+            const Person &m = family[mother], &f = family[father];
+            // Each parent passes on one of its alleles; a single copy is passed with probability 1/2.
+            auto transmit = [&](int alleles) { return alleles == 2 || (alleles == 1 && chance(0.5)); };
+            Person p{father, mother, female, 0};
+            if (options.mode <= 1)
+                p.alleles = transmit(m.alleles) + transmit(f.alleles);
+            else if (options.mode <= 3)
+                p.alleles = transmit(m.alleles) + (female ? f.alleles : 0);
+            else
+                p.alleles = female ? 0 : f.alleles;
+            family.push_back(p);
+            return (int)family.size() - 1;
+        };
+
+        long long budget = options.people - written;
+        couples.assign(1, {founder(true), founder(false)});
+        for (int g = 0; g < options.generations && couples.size() && (long long)family.size() < budget; g++)
+        {
+            nextCouples.clear();
+            for (auto [mother, father] : couples)
+            {
+                int kids = min(sibshipSize(rng), options.sibshipMax);
+                for (int k = 0; k < kids && (long long)family.size() < budget; k++)
+                {
+                    bool female = chance(0.5);
+                    int c = child(mother, father, female);
+                    if ((long long)family.size() < budget && chance(options.marriageRate))
+                    {
+                        int spouse = founder(!female);
+                        nextCouples.push_back(female ? make_pair(c, spouse) : make_pair(spouse, c));
+                    }
+                }
+            }
+            couples.swap(nextCouples);
+        }
+
+        for (int i = 0; i < (int)family.size(); i++)
+        {
+            const Person &p = family[i];
+            bool genetic;
+            if (options.mode == 0 || options.mode == 2 || (options.mode == 3 && !p.female))
+                genetic = p.alleles >= 1;
+            else if (options.mode == 4)
+                genetic = !p.female && p.alleles;
+            else
+                genetic = p.alleles == 2;
+            bool affected = chance(genetic ? options.penetrance : options.phenocopy);
+
+            text += 'F';
+            put(fam);
+            text += ' ';
+            put(i + 1);
+            text += ' ';
+            put(p.father + 1);
+            text += ' ';
+            put(p.mother + 1);
+            text += p.female ? " 2" : " 1";
+            text += affected ? " 2\n" : " 1\n";
+        }
+        written += family.size();
+    }
+    return text;
+}
+
+#endif
@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+# Pedigree Analysis - brute-force checks.
+# Usage: tests/brute.py <program> <check> [trials [seed] | file.ped]
+# Builds small random pedigrees (or reads one), sums over every genotype
+# assignment and compares the sums with what the program prints. Prints
+# "bad N" and exits 1 when any value differs.
+
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+# A mode is one table per sex (0 male, 1 female):
+# (states, penetrance[state], gamete[state] = P(passes the D allele),
+#  allele from the mother[state], allele from the father[state], complement).
+# D / R: the state takes the D / R allele from that parent (PedigreeModes.h); NA: none.
+# The complement state's probability is 1 minus the others'.
+D, R, NA = 0, 1, -1
+autosomalDominant = (3, [1, 1, 0], [1, .5, 0], [D, NA, R], [D, NA, R], 1)
+autosomalRecessive = (3, [0, 0, 1], [1, .5, 0], [D, NA, R], [D, NA, R], 1)
+modes = [
+    [autosomalDominant, autosomalDominant],
+    [autosomalRecessive, autosomalRecessive],
+    [(2, [1, 0], [1, 0], [D, R], [NA, NA], -1), autosomalDominant],
+    [(2, [0, 1], [1, 0], [D, R], [NA, NA], -1), autosomalRecessive],
+    [(2, [1, 0], [1, 0], [NA, NA], [D, R], -1), (1, [0], [0], [NA], [NA], -1)],
+]
+modeNames = ["AD", "AR", "XLD", "XLR", "YL"]
+# The allele that causes the trait, TraitAllele() in PedigreeModes.h.
+carrierAllele = [D, R, D, R, D]
+
+
+def gamete(table, state, allele):
+    return table[2][state] if allele == D else 1 - table[2][state]
+
+
+def childProbability(mode, sex, state, mother, father):
+    table = mode[sex]
+    if state == table[5]:
+        return 1 - sum(childProbability(mode, sex, other, mother, father)
+                       for other in range(table[0]) if other != state)
+    p = 1.0
+    if table[3][state] != NA:
+        p *= gamete(mode[1], mother, table[3][state])
+    if table[4][state] != NA:
+        p *= gamete(mode[0], father, table[4][state])
+    return p
+
+
+def founderPrior(table, state, q, trait):
+    """Hardy-Weinberg for allele frequency q of the trait allele; uniform without a q."""
+    if q is None:
+        return 1.0 / table[0]
+    if state == table[5]:
+        return 1 - sum(founderPrior(table, other, q, trait) for other in range(table[0]) if other != state)
+    p = 1.0
+    for allele in (table[3][state], table[4][state]):
+        if allele != NA:
+            p *= q if allele == trait else 1 - q
+    return p
+
+
+def penetrance(table, state, model):
+    q, f, p, trait = model
+    return p + (f - p) * table[1][state]
+
+
+def assignments(people, mode, visit, model=(None, 1, 0, D)):
+    """Calls visit(states, weight) for every genotype assignment of nonzero weight.
+    people: (father, mother, female, affected) in order, parents first.
+    model: (q, penetrance, phenocopy, trait allele) as --sweep takes them; q None is uniform."""
+    states = [0] * len(people)
+
+    def step(i, weight):
+        if i == len(people):
+            visit(states, weight)
+            return
+        father, mother, female, affected = people[i]
+        table = mode[female]
+        for state in range(table[0]):
+            if father < 0:
+                prior = founderPrior(table, state, model[0], model[3])
+            else:
+                prior = childProbability(mode, female, state, states[mother], states[father])
+            pen = penetrance(table, state, model)
+            w = prior * (pen if affected else 1 - pen)
+            if w:
+                states[i] = state
+                step(i + 1, weight * w)
+    step(0, 1.0)
+
+
+def likelihood(people, mode, model=(None, 1, 0, D)):
+    total = [0.0]
+
+    def visit(states, weight):
+        total[0] += weight
+    assignments(people, mode, visit, model)
+    return total[0]
+
+
+def posteriors(people, m):
+    """Per person, the state posteriors and the carrier probability under mode m; None if impossible."""
+    mode = modes[m]
+    sums = [[0.0] * 3 for _ in people]
+    total = [0.0]
+
+    def visit(states, weight):
+        total[0] += weight
+        for p, state in enumerate(states):
+            sums[p][state] += weight
+    assignments(people, mode, visit)
+    if not total[0]:
+        return None, None, 0.0
+    posterior = [[s / total[0] for s in row] for row in sums]
+    carrier = [sum(posterior[p][s] for s in range(mode[people[p][2]][0]) if gamete(mode[people[p][2]], s, carrierAllele[m]) > 0)
+               for p in range(len(people))]
+    return posterior, carrier, total[0]
+
+
+def generate(rng, smallest=3, largest=11, loops=False):
+    """A random family: a founder couple, children, their spouses and a few second partners.
+    With loops, some children marry a relative instead."""
+    people = []
+
+    def add(father, mother, female):
+        people.append((father, mother, female, rng.random() < .35))
+        return len(people) - 1
+    couples = [(add(-1, -1, True), add(-1, -1, False))]
+    target = rng.randint(smallest, largest)
+    while len(people) < target and couples:
+        mother, father = couples.pop(0)
+        for _ in range(rng.randint(1, 3)):
+            if len(people) >= target:
+                break
+            female = rng.random() < .5
+            child = add(father, mother, female)
+            relatives = [p for p in range(child) if people[p][0] >= 0 and people[p][2] != female]
+            if loops and relatives and rng.random() < .6:
+                spouse = rng.choice(relatives)
+                couples.append((child, spouse) if female else (spouse, child))
+            elif rng.random() < .6 and len(people) < target:
+                spouse = add(-1, -1, not female)
+                couples.append((child, spouse) if female else (spouse, child))
+        if rng.random() < .3 and len(people) < target:
+            couples.append((mother, add(-1, -1, False)))
+    return people
+
+
+def nuclear(rng):
+    """A founder couple and their children, and sometimes an unrelated founder:
+    pedigrees on which the forward pass is exact, given the parents."""
+    people = [(-1, -1, True, rng.random() < .35), (-1, -1, False, rng.random() < .35)]
+    for _ in range(rng.randint(1, 6)):
+        people.append((1, 0, rng.random() < .5, rng.random() < .35))
+    if rng.random() < .3:
+        people.append((-1, -1, rng.random() < .5, rng.random() < .35))
+    return people
+
+
+def readPed(path):
+    """The inverse of writePed(), for a PED file that lists parents before their children."""
+    index, people = {"0": -1}, []
+    with open(path) as file:
+        for line in file:
+            if line.split():
+                _, id_, father, mother, sex, affected = line.split()[:6]
+                index[id_] = len(people)
+                people.append((index[father], index[mother], sex == "2", affected == "2"))
+    return people
+
+
+def writePed(people, path):
+    def id_(p):
+        return "P%d" % (p + 1) if p >= 0 else "0"
+    with open(path, "w") as file:
+        for i, (father, mother, female, affected) in enumerate(people):
+            file.write("F P%d %s %s %d %d\n" % (i + 1, id_(father), id_(mother), 2 if female else 1, 2 if affected else 1))
+
+
+def run(program, work, *arguments):
+    return subprocess.run([program, *arguments], cwd=work, capture_output=True, text=True, check=True)
+
+
+def close(text, expected, tolerance):
+    if expected is None:
+        return text == "NA"
+    return text != "NA" and abs(float(text) - expected) < tolerance
+
+
+def checkPeeling(program, people, work):
+    """--engine peeling --batch: every mode's log-likelihood to 1e-7."""
+    ped = os.path.join(work, "b.ped")
+    writePed(people, ped)
+    out = run(program, work, "--input", ped, "--engine", "peeling", "--batch")
+    row = out.stdout.split("\n")[1].split("\t")[4:9]
+    errors = []
+    for m in range(5):
+        total = likelihood(people, modes[m])
+        expected = math.log(total) if total else None
+        if not (row[m] == "-inf" if expected is None else row[m] != "-inf" and abs(float(row[m]) - expected) < 1e-7):
+            errors.append("%s: %s, expected %s" % (modeNames[m], row[m], expected))
+    return errors
+
+
+def checkMcmc(program, people, work):
+    """--engine mcmc on families with loops: every estimate within four of its reported errors.
+    Sixteen chains, so the spread between them is a steady estimate of the error."""
+    ped = os.path.join(work, "b.ped")
+    writePed(people, ped)
+    out = run(program, work, "--input", ped, "--export", "none", "--engine", "mcmc",
+              "--mcmc-chains", "16", "--mcmc-sweeps", "1000")
+    lines = out.stdout.split("\n")
+    table = lines[lines.index("MCMC estimates (log-likelihood, error, R-hat):") + 1:][:5]
+    errors = []
+    for m, line in enumerate(table):
+        name, estimate, error, _ = line.split("\t")
+        total = likelihood(people, modes[m])
+        if not total or estimate == "-inf":
+            if bool(total) != (estimate != "-inf"):
+                errors.append("%s: %s, expected log %s" % (name, estimate, total))
+        elif abs(float(estimate) - math.log(total)) > 4 * float(error):
+            errors.append("%s: %s +- %s, expected %.6f" % (name, estimate, error, math.log(total)))
+    return errors
+
+
+def checkSweep(program, people, work):
+    """--sweep on nuclear families: every mode at every grid point against the exact
+    likelihood under that point's founder prior and penetrance, divided by the
+    parents' own affection probabilities, on which the forward pass conditions."""
+    ped, tsv = os.path.join(work, "b.ped"), os.path.join(work, "b.tsv")
+    writePed(people, ped)
+    run(program, work, "--input", ped, "--export", "none", "--sweep", tsv,
+        "--sweep-q", "0.01,0.3,uniform", "--sweep-penetrance", "0.7,1", "--sweep-phenocopy", "0,0.05")
+    parents = set(p for person in people for p in person[:2] if p >= 0)
+    errors = []
+    with open(tsv) as file:
+        file.readline()
+        for line in file:
+            row = line.rstrip("\n").split("\t")
+            q = None if row[0] == "uniform" else float(row[0])
+            for m in range(5):
+                model = (q, float(row[1]), float(row[2]), carrierAllele[m])
+                total = likelihood(people, modes[m], model)
+                for p in parents:
+                    alone = likelihood([(-1, -1) + people[p][2:]], modes[m], model)
+                    total = total / alone if alone else 0
+                expected = math.log(total) if total else None
+                if not (row[3 + m] == "-inf" if expected is None else
+                        row[3 + m] != "-inf" and abs(float(row[3 + m]) - expected) < 1e-7 * max(1, abs(expected))):
+                    errors.append("%s at %s: %s, expected %s" % (modeNames[m], " ".join(row[:3]), row[3 + m], expected))
+    return errors
+
+
+def checkPosteriors(program, people, work):
+    """--posteriors: every state posterior, every carrier probability and the mode-averaged risk."""
+    ped, tsv = os.path.join(work, "b.ped"), os.path.join(work, "b.tsv")
+    writePed(people, ped)
+    run(program, work, "--input", ped, "--export", "none", "--posteriors", tsv)
+    with open(tsv) as file:
+        columns = file.readline().rstrip("\n").split("\t")
+        rows = [line.rstrip("\n").split("\t") for line in file if line.strip()]
+    results = [posteriors(people, m) for m in range(5)]
+    total = sum(r[2] for r in results)
+    errors = [] if len(rows) == len(people) else ["%d rows for %d people" % (len(rows), len(people))]
+    for p, row in enumerate(rows):
+        k = 3
+        for m in range(5):
+            posterior = results[m][0]
+            for s in range(len([c for c in columns if c.startswith(modeNames[m] + ".") and not c.endswith("carrier")])):
+                female = people[p][2]
+                expected = None if posterior is None or s >= modes[m][female][0] else posterior[p][s]
+                if not close(row[k], expected, 1e-5):
+                    errors.append("person %d %s state %d: %s, expected %s" % (p + 1, modeNames[m], s, row[k], expected))
+                k += 1
+        for m in range(5):
+            carrier = results[m][1]
+            if not close(row[k], carrier and carrier[p], 1e-5):
+                errors.append("person %d %s carrier: %s, expected %s" % (p + 1, modeNames[m], row[k], carrier and carrier[p]))
+            k += 1
+        risk = sum(r[2] / total * r[1][p] for r in results if r[2]) if total else None
+        if not close(row[k], risk, 1e-5):
+            errors.append("person %d carrier: %s, expected %s" % (p + 1, row[k], risk))
+    return errors
+
+
+checks = {"peeling": checkPeeling, "mcmc": checkMcmc, "sweep": checkSweep, "posteriors": checkPosteriors}
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3 or sys.argv[2] not in checks:
+        sys.exit("Usage: brute.py <program> <%s> [trials [seed] | file.ped]" % "|".join(checks))
+    program, check = os.path.abspath(sys.argv[1]), checks[sys.argv[2]]
+    given = readPed(sys.argv[3]) if len(sys.argv) > 3 and sys.argv[3].endswith(".ped") else None
+    trials = 1 if given else int(sys.argv[3]) if len(sys.argv) > 3 else 100
+    rng = random.Random(int(sys.argv[4]) if len(sys.argv) > 4 else 1)
+    bad = 0
+    with tempfile.TemporaryDirectory() as work:
+        for trial in range(trials):
+            people = given or (nuclear(rng) if check == checkSweep else generate(rng, loops=check == checkMcmc))
+            for error in check(program, people, work):
+                print("trial %d: %s" % (trial, error))
+                bad += 1
+    print("bad", bad)
+    sys.exit(1 if bad else 0)
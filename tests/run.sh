@@ -0,0 +1,186 @@
+#!/bin/sh
+# Pedigree Analysis - regression checks.
+# Usage: tests/run.sh [program]. Without a program, one is built from the
+# sources with ${CXX:-g++} first. Prints FAIL lines and exits 1 if any check fails.
+
+dir=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+program=${1:-}
+if [ -z "$program" ]; then
+    program=$work/PedigreeAnalysis
+    ${CXX:-g++} -O2 -std=c++17 -pthread -o "$program" "$dir"/../Pedigree*.cpp || exit 1
+fi
+case $program in /*) ;; *) program=$(pwd)/$program ;; esac
+cd "$work" || exit 1 # The default export writes pedigree.dot here.
+
+failed=0
+fail()
+{
+    echo "FAIL: $*"
+    failed=1
+}
+# The report: the last seven lines, without the prompt the interactive reader leaves in front.
+report()
+{
+    tail -n 7 "$1" | sed 's/^.*-> //'
+}
+# Every mode's log-likelihood in the report, whatever their order: edits sum
+# differently, and modes tied exactly may come out in another order.
+likelihoods()
+{
+    tail -n 5 "$1" | sed 's/^[1-5]) \([^ ]*\) for \([^(]*\) (.*/\2 \1/' | sort
+}
+# The forward pass's log-likelihoods in the --engine both table, one per line.
+forward()
+{
+    awk '/^Forward pass vs exact/ { table = 1; next } table { print $2 }'
+}
+# Whether the log-likelihoods on stdin match those in $1, line by line, to 1e-9 relative.
+close()
+{
+    paste "$1" - | awk '
+        $1 == "-inf" || $2 == "-inf" { if ($1 != $2) bad = 1; next }
+        { d = $1 - $2; m = $1 < -1 ? -$1 : 1; if (d > 1e-9 * m || -d > 1e-9 * m) bad = 1 }
+        END { exit bad }'
+}
+
+# data/<name>.txt answers the interactive prompts; data/<name>.out is its report,
+# and data/<name>.ped / .csv are the same pedigree, which must rank the same.
+for input in "$dir"/data/*.txt; do
+    name=$(basename "$input" .txt)
+    "$program" --export none < "$input" > "$name.run" 2>/dev/null
+    status=$?
+    if [ $status != 0 ]; then
+        fail "$name: interactive run exited with $status"
+        continue
+    fi
+    report "$name.run" | cmp -s - "$dir/data/$name.out" || fail "$name: interactive report differs from data/$name.out"
+    for format in ped csv; do
+        [ -f "$dir/data/$name.$format" ] || continue
+        "$program" --export none --input "$dir/data/$name.$format" > "$name.$format.run" 2>/dev/null ||
+            fail "$name.$format: exited with $?"
+        cmp -s "$name.$format.run" "$dir/data/$name.out" || fail "$name.$format: report differs from data/$name.out"
+    done
+
+    # Posteriors of an interactive pedigree: people numbered from 1, the same
+    # values as the PED file's.
+    if [ -f "$dir/data/$name.ped" ]; then
+        "$program" --export none --posteriors - < "$input" > "$name.posteriors" 2>/dev/null ||
+            fail "$name: --posteriors - exited with $?"
+        sed -n '/^person/,$p' "$name.posteriors" > "$name.tsv"
+        "$program" --export none --input "$dir/data/$name.ped" --posteriors "$name.ped.tsv" > /dev/null 2>&1
+        people=$(head -n 1 "$input")
+        [ "$(cut -f 1 "$name.tsv" | tail -n +2 | tr '\n' ' ')" = "$(seq -s ' ' 1 "$people") " ] ||
+            fail "$name: --posteriors - does not number people 1 to $people"
+        cut -f 2- "$name.ped.tsv" > "$name.ped.values"
+        cut -f 2- "$name.tsv" | cmp -s - "$name.ped.values" || fail "$name: --posteriors - differs from data/$name.ped's"
+    fi
+
+    # A sweep gives the same surface whichever engine ranks the modes.
+    if [ -f "$dir/data/$name.ped" ]; then
+        for engine in forward peeling mcmc; do
+            "$program" --export none --input "$dir/data/$name.ped" --engine $engine --sweep "$name.$engine.sweep" \
+                --sweep-q 0.01,0.2 --sweep-penetrance 0.8,1 --sweep-phenocopy 0,0.05 > /dev/null 2>&1 ||
+                fail "$name: --engine $engine --sweep exited with $?"
+        done
+        cmp -s "$name.forward.sweep" "$name.peeling.sweep" || fail "$name: --sweep differs under --engine peeling"
+        cmp -s "$name.forward.sweep" "$name.mcmc.sweep" || fail "$name: --sweep differs under --engine mcmc"
+
+        # Uniform founders, penetrance 1 and phenocopy 0 are the forward pass's own model.
+        "$program" --export none --input "$dir/data/$name.ped" --engine both --sweep "$name.uniform.sweep" \
+            --sweep-q uniform 2>/dev/null | forward > "$name.forward"
+        tail -n 1 "$name.uniform.sweep" | cut -f 4-8 | tr '\t' '\n' | close "$name.forward" ||
+            fail "$name: --sweep-q uniform differs from the forward pass"
+    fi
+
+    # Edits on an interactive pedigree: person 1's affection (the sixth
+    # answer) flipped and back gives the first report again.
+    # With --cache, the edits bypass the family cache and end the same way.
+    affected=$(sed -n 6p "$input")
+    for cache in "" "--cache 1"; do
+        { cat "$input"; echo "affect 1 $((1 - affected))"; echo "affect 1 $affected"; echo quit; } |
+            "$program" --export none --edit $cache > "$name.edit" 2>/dev/null || fail "$name: --edit $cache exited with $?"
+        likelihoods "$name.edit" > "$name.edited"
+        likelihoods "$dir/data/$name.out" | cmp -s - "$name.edited" || fail "$name: --edit $cache ends on other log-likelihoods"
+    done
+done
+
+# --traits: each affection column of data/traits.ped scores as the forward pass
+# scores it alone; data/traits.csv holds the same columns, named.
+"$program" --export none --input "$dir/data/traits.ped" --traits traits.tsv > /dev/null 2>&1 &&
+    fail "--traits read the columns after a PED file's affection column without --trait-columns"
+"$program" --export none --input "$dir/data/traits.ped" --traits traits.tsv --trait-columns 7 > /dev/null 2>&1 ||
+    fail "--traits exited with $?"
+traits=$(($(head -n 1 "$dir/data/traits.ped" | wc -w) - 5))
+[ "$(wc -l < traits.tsv)" = $((traits + 1)) ] || fail "--traits: $(($(wc -l < traits.tsv) - 1)) rows for $traits traits"
+for trait in $(seq 1 $traits); do
+    awk -v column=$((trait + 5)) '{ print $1, $2, $3, $4, $5, $column }' "$dir/data/traits.ped" > trait.ped
+    "$program" --export none --input trait.ped --engine both 2>/dev/null | forward > trait.forward
+    sed -n "$((trait + 1))p" traits.tsv | cut -f 2-6 | tr '\t' '\n' | close trait.forward ||
+        fail "--traits: trait $trait differs from the forward pass"
+done
+"$program" --export none --input "$dir/data/traits.csv" --traits traits.csv.tsv > /dev/null 2>&1 || fail "--traits exited with $?"
+[ "$(cut -f 1 traits.csv.tsv | tr '\n' ' ')" = "trait affection dominant recessive xDominant xRecessive yLinked none " ] ||
+    fail "--traits: the CSV's traits are not named by its header"
+cut -f 2- traits.csv.tsv > traits.csv.values
+cut -f 2- traits.tsv | cmp -s - traits.csv.values || fail "--traits: data/traits.csv scores differently from data/traits.ped"
+"$program" --export none --input "$dir/data/traits.ped" --traits traits.some.tsv --trait-columns 8,2 > /dev/null 2>&1 ||
+    fail "--trait-columns 8,2 exited with $?"
+cut -f 2- traits.some.tsv > traits.some.values
+sed -n '1,2p;4,5p' traits.tsv | cut -f 2- | cmp -s - traits.some.values || fail "--trait-columns 8,2 does not score columns 8 and 9"
+
+# --significance under --prune-bound: replicates prune as the observed pedigree
+# does, so a mode the bound keeps is reached by no more permutations than
+# without it, and data/four.ped's modes by fewer.
+for bound in inf 1; do
+    "$program" --export none --input "$dir/data/four.ped" --significance 200 --prune-bound $bound 2>/dev/null |
+        sed -n '/^Model/,$p' | tail -n +2 | sort > four.bound$bound || fail "--significance --prune-bound $bound exited with $?"
+done
+join four.bound1 four.boundinf | awk '
+    $2 != "-inf" { if ($3 > $6) bad = 1; if ($3 < $6) fewer = 1 }
+    END { exit bad || !fewer }' || fail "--significance replicates do not prune under --prune-bound"
+
+# A snapshot of a pedigree with a parent cycle the schedule never reaches
+# loads back and ranks the modes as the PED file does.
+printf 'F1 A B M 1 1\nF1 B A M 1 2\nF1 M 0 0 2 1\nF1 C D E 1 2\nF1 D 0 0 1 1\nF1 E 0 0 2 2\n' > cycle.ped
+"$program" --export none --input cycle.ped --save-snapshot cycle.snap > cycle.out 2>/dev/null ||
+    fail "--save-snapshot of a parent cycle exited with $?"
+"$program" --export none --snapshot cycle.snap > cycle.snap.out 2>/dev/null || fail "--snapshot of a parent cycle exited with $?"
+cmp -s cycle.out cycle.snap.out || fail "--snapshot of a parent cycle reports differently from its PED file"
+
+# An MCMC run too short for any sample to fit a mode genotype elimination
+# allows is an error, not a mode the pedigree rules out.
+"$program" --export none --input "$dir/data/in1.ped" --engine mcmc --mcmc-chains 1 --mcmc-rungs 3 --mcmc-sweeps 1 \
+    > /dev/null 2>&1 && fail "--engine mcmc reported a mode no sample fitted"
+
+# IDs with control characters still make valid JSON: batch rows, the graph
+# export and a server reply.
+if command -v python3 > /dev/null; then
+    printf 'F\001x A\001 0 0 1 2\nF\001x B 0 0 2 1\nF\001x C A\001 B 1 2\n' > control.ped
+    "$program" --export none --input control.ped --batch --results-format json --results control.rows > /dev/null 2>&1 ||
+        fail "--batch with control characters in IDs exited with $?"
+    "$program" --input control.ped --export json --output control.json > /dev/null 2>&1 ||
+        fail "--export json with control characters in IDs exited with $?"
+    printf '{"id":"r\\u0001","pedigree":"F1 1 0 0 1 2"}\n' | "$program" --serve - > control.reply 2>/dev/null ||
+        fail "--serve - exited with $?"
+    python3 -c 'import json, sys
+json.load(open("control.json"))
+for path in sys.argv[1:]:
+    for line in open(path):
+        json.loads(line)' control.rows control.reply 2>/dev/null ||
+        fail "control characters in IDs make invalid JSON"
+fi
+
+# Small random families against sums over every genotype assignment.
+if command -v python3 > /dev/null; then
+    for check in peeling mcmc sweep posteriors; do
+        python3 "$dir/brute.py" "$program" $check 40 > brute.$check || fail "brute.py $check: $(tail -n 1 brute.$check)"
+    done
+    # A cousin marriage: a loop, which only MCMC takes.
+    python3 "$dir/brute.py" "$program" mcmc "$dir/data/cousins.ped" > brute.cousins ||
+        fail "brute.py mcmc data/cousins.ped: $(tail -n 1 brute.cousins)"
+fi
+
+[ $failed = 0 ] && echo "All checks passed."
+exit $failed